@@ -0,0 +1,483 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <windows.h> //for InterlockedExchange() and InterlockedExchangePointer()
+#include <xmmintrin.h> //for sse
+#include <assert.h>
+#include <math.h> //for fabsf()
+
+#include "PolySampler.h"
+
+//out[i] += in[i]*envelope[i], 4 floats per step
+static inline void PolySamplerMixEnvelope(TonicFloat* out, const TonicFloat* in, const TonicFloat* envelope, unsigned int count)
+{
+	unsigned int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		_mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(_mm_loadu_ps(in + i), _mm_loadu_ps(envelope + i))));
+	}
+	for (; i < count; i++) out[i] += in[i] * envelope[i];
+}
+
+namespace Tonic {
+	namespace Tonic_ {
+
+		PolySampler_::PolySampler_()
+		{
+			setIsStereoOutput(true);
+			attack_ = 0.04f;
+			decay_ = 0.1f;
+			sustain_ = 0.8f;
+			release_ = 0.0f;
+			velocitysensitivity_ = 0.0f;
+			stealfade_ = 0.005f;
+			numberofvoices_ = 0;
+			numberofactivevoices_ = 0;
+			blockcount_ = 0;
+			numberofheadstarts_ = 0;
+			numberofheadunderruns_ = 0;
+			for (int v = 0; v < POLYSAMPLER_MAXNUMBEROFVOICES; v++)
+			{
+				voicedata_[v] = NULL;
+				voiceframes_[v] = 0;
+				voiceplayhead_[v] = 0;
+				voicestage_[v] = STAGE_IDLE;
+				voicelevel_[v] = 0.0f;
+				voicereleasestep_[v] = 0.0f;
+				voicegain_[v] = 1.0f;
+				voicestartoffset_[v] = 0;
+				voicereleaseoffset_[v] = -1;
+				requestednote_[v] = -1;
+				requestedvelocity_[v] = 0;
+				requestedbank_[v] = 0;
+				requestedoff_[v] = 0;
+				requestedonoffset_[v] = 0;
+				requestedoffoffset_[v] = 0;
+				voiceamplitudes_[v] = NULL;
+				voiceloudness_[v] = 0.0f;
+				voiceloopstart_[v] = 0;
+				voiceloopend_[v] = 0;
+				voicelastused_[v] = NULL;
+				voicenotedata_[v] = NULL;
+				voiceavailable_[v] = 0;
+				voicestalled_[v] = false;
+			}
+			for (int i = 0; i < POLYSAMPLER_MAXNUMBEROFVOICES / 32; i++)
+			{
+				finishedvoices_[i] = 0;
+			}
+			for (int bank = 0; bank < POLYSAMPLER_MAXNUMBEROFBANKS; bank++)
+			{
+				for (int i = 0; i < POLYSAMPLER_NUMBEROFNOTES; i++)
+				{
+					notedata_[bank][i] = NULL;
+					noteframes_[bank][i] = 0;
+					noteloopstart_[bank][i] = 0;
+					noteloopend_[bank][i] = 0;
+					notelastused_[bank][i] = 0;
+					noteheaddata_[bank][i] = NULL;
+					noteheadframes_[bank][i] = 0;
+				}
+				bankloaded_[bank] = false;
+			}
+			for (int s = 0; s < POLYSAMPLER_MAXNUMBEROFFADES; s++)
+			{
+				fadedata_[s] = NULL;
+				fadeframes_[s] = 0;
+				fadeplayhead_[s] = 0;
+				fadeframesleft_[s] = 0;
+				fadelevel_[s] = 0.0f;
+				fadestep_[s] = 0.0f;
+				fadelastused_[s] = NULL;
+			}
+		}
+
+		void PolySampler_::setNoteBank(int bank, SampleTable** tables)
+		{
+			assert(bank >= 0 && bank < POLYSAMPLER_MAXNUMBEROFBANKS);
+			const TonicFloat* data[POLYSAMPLER_NUMBEROFNOTES];
+			unsigned int frames[POLYSAMPLER_NUMBEROFNOTES];
+			notebanks_[bank].clear();
+			for (int i = 0; i < POLYSAMPLER_NUMBEROFNOTES; i++)
+			{
+				assert(tables[i]->channels() == 2);
+				notebanks_[bank].push_back(*(tables[i])); //keeps the tables alive
+				data[i] = tables[i]->dataPointer();
+				frames[i] = tables[i]->frames();
+			}
+			setNoteData(bank, data, frames);
+		}
+
+		void PolySampler_::setNoteBank(int bank, const TonicFloat* const* data, const unsigned int* frames)
+		{
+			assert(bank >= 0 && bank < POLYSAMPLER_MAXNUMBEROFBANKS);
+			notebanks_[bank].clear(); //the caller owns the note data
+			setNoteData(bank, data, frames);
+		}
+
+		void PolySampler_::setNoteData(int bank, const TonicFloat* const* notedata, const unsigned int* noteframes)
+		{
+			noteamplitudes_[bank].clear();
+			noteamplitudes_[bank].resize(POLYSAMPLER_NUMBEROFNOTES);
+			for (int i = 0; i < POLYSAMPLER_NUMBEROFNOTES; i++)
+			{
+				notedata_[bank][i] = notedata[i];
+				noteframes_[bank][i] = noteframes[i];
+				noteloopstart_[bank][i] = 0;
+				noteloopend_[bank][i] = 0;
+				noteheaddata_[bank][i] = NULL;
+				noteheadframes_[bank][i] = 0;
+
+				//peak of both channels per chunk, one extra entry so a playhead at the end stays in range
+				const TonicFloat* data = notedata[i];
+				unsigned int frames = noteframes[i];
+				vector<TonicFloat>& amplitudes = noteamplitudes_[bank][i];
+				if (data == NULL)
+				{
+					amplitudes.assign((frames >> POLYSAMPLER_AMPLITUDESHIFT) + 1, 1.0f); //data not resident yet, counted as full scale
+					continue;
+				}
+				amplitudes.assign((frames >> POLYSAMPLER_AMPLITUDESHIFT) + 1, 0.0f);
+				for (unsigned int f = 0; f < frames; f++)
+				{
+					TonicFloat peak = fabsf(data[2 * f]) > fabsf(data[2 * f + 1]) ? fabsf(data[2 * f]) : fabsf(data[2 * f + 1]);
+					if (peak > amplitudes[f >> POLYSAMPLER_AMPLITUDESHIFT]) amplitudes[f >> POLYSAMPLER_AMPLITUDESHIFT] = peak;
+				}
+			}
+			bankloaded_[bank] = true;
+		}
+
+		void PolySampler_::setNoteLoops(int bank, const unsigned int* loopstarts, const unsigned int* loopends)
+		{
+			assert(bank >= 0 && bank < POLYSAMPLER_MAXNUMBEROFBANKS && bankloaded_[bank]);
+			for (int i = 0; i < POLYSAMPLER_NUMBEROFNOTES; i++)
+			{
+				bool valid = loopstarts[i] < loopends[i] && loopends[i] <= noteframes_[bank][i];
+				noteloopstart_[bank][i] = valid ? loopstarts[i] : 0;
+				noteloopend_[bank][i] = valid ? loopends[i] : 0;
+			}
+		}
+
+		void PolySampler_::setNoteDataPointer(int bank, int note, const TonicFloat* data)
+		{
+			assert(bank >= 0 && bank < POLYSAMPLER_MAXNUMBEROFBANKS && note >= 0 && note < POLYSAMPLER_NUMBEROFNOTES);
+			InterlockedExchangePointer((void* volatile*)&notedata_[bank][note], (void*)data);
+		}
+
+		void PolySampler_::setNoteHead(int bank, int note, const TonicFloat* data, unsigned int frames)
+		{
+			assert(bank >= 0 && bank < POLYSAMPLER_MAXNUMBEROFBANKS && note >= 0 && note < POLYSAMPLER_NUMBEROFNOTES);
+			noteheaddata_[bank][note] = data;
+			noteheadframes_[bank][note] = (data != NULL && frames < noteframes_[bank][note]) ? frames : 0;
+		}
+
+		void PolySampler_::setNumberOfVoices(int numberofvoices)
+		{
+			assert(numberofvoices <= POLYSAMPLER_MAXNUMBEROFVOICES);
+			numberofvoices_ = numberofvoices;
+		}
+
+		void PolySampler_::noteOn(int voice, int note, int velocity, int frameoffset, int bank)
+		{
+			requestedoff_[voice] = 0; //a new note supersedes a pending note off
+			requestedvelocity_[voice] = velocity;
+			requestedbank_[voice] = bank;
+			requestedonoffset_[voice] = frameoffset;
+			requestednote_[voice] = note;
+		}
+
+		void PolySampler_::noteOff(int voice, int frameoffset)
+		{
+			requestedoffoffset_[voice] = frameoffset;
+			requestedoff_[voice] = 1;
+		}
+
+		void PolySampler_::stopVoice(int voice)
+		{
+			requestedoff_[voice] = 2;
+		}
+
+		void PolySampler_::takeFinishedVoices(unsigned long* mask)
+		{
+			for (int i = 0; i < POLYSAMPLER_MAXNUMBEROFVOICES / 32; i++)
+			{
+				mask[i] = (unsigned long)InterlockedExchange(&finishedvoices_[i], 0);
+			}
+		}
+
+		void PolySampler_::startRelease(int v)
+		{
+			voicestage_[v] = STAGE_RELEASE;
+			voicereleasestep_[v] = (release_ > 0.0f) ? voicelevel_[v] / (release_ * Tonic::sampleRate()) : voicelevel_[v];
+		}
+
+		//hands the note of a sounding voice over to a free fade slot, a hard cut when none is free
+		void PolySampler_::startFade(int v)
+		{
+			unsigned int fadeframes = (unsigned int)(stealfade_ * Tonic::sampleRate());
+			if (fadeframes == 0 || voiceplayhead_[v] >= voiceavailable_[v]) return;
+			for (int s = 0; s < POLYSAMPLER_MAXNUMBEROFFADES; s++)
+			{
+				if (fadeframesleft_[s] == 0)
+				{
+					fadedata_[s] = voicedata_[v];
+					fadeframes_[s] = voiceavailable_[v]; //the head only while on it
+					fadeplayhead_[s] = voiceplayhead_[v];
+					fadeframesleft_[s] = fadeframes;
+					fadelevel_[s] = voicelevel_[v] * voicegain_[v];
+					fadestep_[s] = fadelevel_[s] / fadeframes;
+					fadelastused_[s] = voicelastused_[v];
+					return;
+				}
+			}
+		}
+
+		void PolySampler_::renderFades(TonicFloat* out)
+		{
+			for (int s = 0; s < POLYSAMPLER_MAXNUMBEROFFADES; s++)
+			{
+				if (fadeframesleft_[s] == 0) continue;
+				*fadelastused_[s] = blockcount_ + 1;
+				unsigned int numberofframes = fadeframes_[s] - fadeplayhead_[s];
+				if (numberofframes > fadeframesleft_[s]) numberofframes = fadeframesleft_[s];
+				if (numberofframes > kSynthesisBlockSize) numberofframes = kSynthesisBlockSize;
+				TonicFloat level = fadelevel_[s];
+				for (unsigned int f = 0; f < numberofframes; f++)
+				{
+					level -= fadestep_[s];
+					if (level < 0.0f) level = 0.0f;
+					envelope_[2 * f] = envelope_[2 * f + 1] = level;
+				}
+				PolySamplerMixEnvelope(out, fadedata_[s] + 2 * fadeplayhead_[s], envelope_, 2 * numberofframes);
+				fadelevel_[s] = level;
+				fadeplayhead_[s] += numberofframes;
+				fadeframesleft_[s] -= numberofframes;
+				if (fadeplayhead_[s] >= fadeframes_[s]) fadeframesleft_[s] = 0; //end of the note table
+			}
+		}
+
+		void PolySampler_::applyRequests()
+		{
+			for (int v = 0; v < numberofvoices_; v++)
+			{
+				int note = (int)InterlockedExchange(&requestednote_[v], -1);
+				if (note >= 0 && bankloaded_[requestedbank_[v]]) notelastused_[requestedbank_[v]][note] = blockcount_ + 1;
+				const TonicFloat* data = (note >= 0) ? notedata_[requestedbank_[v]][note] : NULL;
+				unsigned int available = (note >= 0) ? noteframes_[requestedbank_[v]][note] : 0;
+				if (note >= 0 && data == NULL && noteheadframes_[requestedbank_[v]][note] > 0)
+				{
+					data = noteheaddata_[requestedbank_[v]][note]; //withdrawn, start on the head while it is reloaded
+					available = noteheadframes_[requestedbank_[v]][note];
+					numberofheadstarts_++;
+				}
+				if (note >= 0 && bankloaded_[requestedbank_[v]] && data != NULL) //no tables for that bank or no data for that note, the note is dropped
+				{
+					//voicedata_[v] = notetables_[note].dataPointer();
+					//voiceframes_[v] = notetables_[note].frames();
+					if (voicestage_[v] != STAGE_IDLE) startFade(v); //stolen, fade out the note it was playing
+					//SampleTable& table = notebanks_[requestedbank_[v]][note];
+					voiceamplitudes_[v] = &noteamplitudes_[requestedbank_[v]][note][0];
+					voiceloopstart_[v] = noteloopstart_[requestedbank_[v]][note];
+					voiceloopend_[v] = noteloopend_[requestedbank_[v]][note];
+					voicedata_[v] = data;
+					voicelastused_[v] = &notelastused_[requestedbank_[v]][note];
+					voicenotedata_[v] = &notedata_[requestedbank_[v]][note];
+					voiceframes_[v] = noteframes_[requestedbank_[v]][note];
+					voiceavailable_[v] = available;
+					voicestalled_[v] = false;
+					voiceplayhead_[v] = 0;
+					voicestage_[v] = STAGE_ATTACK;
+					voicelevel_[v] = 0.0f;
+					voicegain_[v] = 1.0f - velocitysensitivity_ + velocitysensitivity_ * requestedvelocity_[v] / 127.0f;
+					voicestartoffset_[v] = (unsigned int)requestedonoffset_[v];
+					voicereleaseoffset_[v] = -1;
+				}
+				long off = InterlockedExchange(&requestedoff_[v], 0);
+				if (off == 2 && voicestage_[v] != STAGE_IDLE)
+				{
+					startFade(v);
+					voicestage_[v] = STAGE_IDLE;
+				}
+				else if (off && voicestage_[v] != STAGE_IDLE)
+				{
+					if (requestedoffoffset_[v] > 0)
+						voicereleaseoffset_[v] = (int)requestedoffoffset_[v]; //taken when the block is rendered
+					else
+						startRelease(v);
+				}
+			}
+		}
+
+		//fills envelope_ from firstframe up to lastframe, returns the frame at which
+		//rendering stopped, earlier than lastframe when the voice went idle
+		unsigned int PolySampler_::renderEnvelope(int v, unsigned int firstframe, unsigned int lastframe)
+		{
+			TonicFloat samplerate = Tonic::sampleRate();
+			TonicFloat level = voicelevel_[v];
+			TonicFloat gain = voicegain_[v];
+			int stage = voicestage_[v];
+			unsigned int f = firstframe;
+			while (f < lastframe && stage != STAGE_IDLE)
+			{
+				if (stage == STAGE_SUSTAIN)
+				{
+					for (; f < lastframe; f++)
+					{
+						envelope_[2 * f] = envelope_[2 * f + 1] = level * gain;
+					}
+					break;
+				}
+
+				TonicFloat step;
+				TonicFloat target;
+				int nextstage;
+				if (stage == STAGE_ATTACK)
+				{
+					step = (attack_ > 0.0f) ? 1.0f / (attack_ * samplerate) : 1.0f;
+					target = 1.0f;
+					nextstage = STAGE_DECAY;
+				}
+				else if (stage == STAGE_DECAY)
+				{
+					step = (decay_ > 0.0f) ? -(1.0f - sustain_) / (decay_ * samplerate) : -1.0f;
+					target = sustain_;
+					nextstage = STAGE_SUSTAIN;
+				}
+				else
+				{
+					step = -voicereleasestep_[v];
+					target = 0.0f;
+					nextstage = STAGE_IDLE;
+				}
+
+				//linear ramp until the segment target is reached
+				for (; f < lastframe; f++)
+				{
+					level += step;
+					bool reached = (step > 0.0f) ? (level >= target) : (level <= target);
+					if (reached) level = target;
+					envelope_[2 * f] = envelope_[2 * f + 1] = level * gain;
+					if (reached)
+					{
+						f++;
+						stage = nextstage;
+						break;
+					}
+				}
+			}
+			voicelevel_[v] = level;
+			voicestage_[v] = stage;
+			return f;
+		}
+
+		void PolySampler_::computeSynthesisBlock(const SynthesisContext_ &context)
+		{
+			applyRequests();
+
+			numberofactivevoices_ = 0;
+			for (int v = 0; v < numberofvoices_; v++)
+			{
+				if (voicestage_[v] != STAGE_IDLE) activevoices_[numberofactivevoices_++] = v;
+				else voiceloudness_[v] = 0.0f;
+			}
+
+			outputFrames_.clear();
+			TonicFloat* out = outputFrames_.dataPointer();
+			renderFades(out);
+			for (int i = 0; i < numberofactivevoices_; i++)
+			{
+				int v = activevoices_[i];
+				*voicelastused_[v] = blockcount_ + 1;
+				if (voiceavailable_[v] < voiceframes_[v])
+				{
+					//on the head of a withdrawn note, the head is a copy of the first frames of the data
+					const TonicFloat* data = *voicenotedata_[v];
+					if (data != NULL)
+					{
+						voicedata_[v] = data;
+						voiceavailable_[v] = voiceframes_[v];
+					}
+					else if (voiceplayhead_[v] >= voiceavailable_[v])
+					{
+						//head played through before the note was back, the voice waits for it. a release
+						//cannot run without data, a note off or a steal ends the waiting voice
+						if (!voicestalled_[v]) InterlockedIncrement(&numberofheadunderruns_);
+						voicestalled_[v] = true;
+						if (voicereleaseoffset_[v] >= 0 || voicestage_[v] == STAGE_RELEASE)
+						{
+							voicestage_[v] = STAGE_IDLE;
+							voiceloudness_[v] = 0.0f;
+							InterlockedOr(&finishedvoices_[v >> 5], (long)(1UL << (v & 31)));
+						}
+						voicestartoffset_[v] = 0;
+						voicereleaseoffset_[v] = -1;
+						continue;
+					}
+				}
+				unsigned int firstframe = voicestartoffset_[v];
+				unsigned int remaining = voiceavailable_[v] - voiceplayhead_[v];
+				//held notes wrap at their loop end, once the loop is in the data
+				bool looping = voiceloopend_[v] > 0 && voicestage_[v] != STAGE_RELEASE && voiceloopend_[v] <= voiceavailable_[v];
+				if (looping) remaining = kSynthesisBlockSize;
+				unsigned int lastframe = (remaining < kSynthesisBlockSize - firstframe) ? firstframe + remaining : kSynthesisBlockSize;
+				unsigned int endframe;
+				int releaseframe = voicereleaseoffset_[v];
+				if (releaseframe >= 0 && (unsigned int)releaseframe < lastframe)
+				{
+					//note off inside the block, envelope up to the release frame then release
+					if ((unsigned int)releaseframe < firstframe) releaseframe = firstframe;
+					endframe = renderEnvelope(v, firstframe, releaseframe);
+					if (endframe == (unsigned int)releaseframe && voicestage_[v] != STAGE_IDLE)
+					{
+						startRelease(v);
+						endframe = renderEnvelope(v, releaseframe, lastframe);
+					}
+				}
+				else
+				{
+					endframe = renderEnvelope(v, firstframe, lastframe);
+				}
+				voicestartoffset_[v] = 0;
+				voicereleaseoffset_[v] = -1;
+				for (unsigned int f = firstframe; f < endframe;)
+				{
+					if (looping && voiceplayhead_[v] >= voiceloopend_[v]) voiceplayhead_[v] = voiceloopstart_[v];
+					unsigned int segmentframes = endframe - f;
+					if (looping && voiceplayhead_[v] + segmentframes > voiceloopend_[v]) segmentframes = voiceloopend_[v] - voiceplayhead_[v];
+					PolySamplerMixEnvelope(out + 2 * f, voicedata_[v] + 2 * voiceplayhead_[v], envelope_ + 2 * f, 2 * segmentframes);
+					voiceplayhead_[v] += segmentframes;
+					f += segmentframes;
+				}
+				if (!looping && voiceplayhead_[v] >= voiceframes_[v])
+				{
+					voicestage_[v] = STAGE_IDLE; //end of the note table, the voice is silent from now on
+					InterlockedOr(&finishedvoices_[v >> 5], (long)(1UL << (v & 31))); //the allocator frees it on the next note event
+				}
+				voiceloudness_[v] = (voicestage_[v] == STAGE_IDLE) ? 0.0f : voicelevel_[v] * voicegain_[v] * voiceamplitudes_[v][voiceplayhead_[v] >> POLYSAMPLER_AMPLITUDESHIFT];
+			}
+			blockcount_++; //the note stamps of this block are all written
+		}
+
+	}
+}
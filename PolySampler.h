@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef POLYSAMPLER_H
+#define POLYSAMPLER_H
+
+#include "Tonic.h"
+#include <vector>
+
+using namespace Tonic;
+
+#define POLYSAMPLER_MAXNUMBEROFVOICES	128
+#define POLYSAMPLER_NUMBEROFNOTES		128
+#define POLYSAMPLER_MAXNUMBEROFBANKS	16 //one note bank per sampler module when the voices are shared
+#define POLYSAMPLER_MAXNUMBEROFFADES	32 //stolen voices fading out at the same time, a steal beyond that is a hard cut
+#define POLYSAMPLER_AMPLITUDESHIFT		10 //note table peak amplitude is kept per 1024 frames
+
+//EXPERIMENTAL, selected with command-line argument 26 and off by default. the voice
+//count comparison against the graph (spitonicbenchmark) has not been run yet.
+//
+//native polyphonic sample player, a replacement for one Tonic Synth graph per voice
+//(SuperBufferPlayer, ADSR and a multiplier). all the voices of a module are kept in
+//structure of arrays form (playheads, envelope stages and levels, gains) and every
+//sounding voice is rendered by one loop that mixes its note table into the output
+//with an SSE multiply-accumulate over the block's stereo frames.
+//
+//noteOn()/noteOff() post requests that are picked up at the start of the next
+//synthesis block. the frame offset places the note start or the release at an
+//exact frame of that block, for sample accurate timing of queued midi events.
+//
+//a sampler can hold the note banks of several modules, the bank is picked per note
+//so that one set of voices can serve every module (see the global voice pool).
+//
+//a voice retriggered while still sounding (a stolen voice) is not cut, its note is
+//handed over to a fade slot that ramps it to zero over a few milliseconds. the
+//loudness of every voice (envelope level times the peak of its note table around
+//the playhead) is updated once per block for the voice allocator, see getVoiceLevel().
+//
+//a note with a sustain loop (setNoteLoops()) jumps from its loop end back to its loop
+//start for as long as it is held, the crossfade is baked into the note table. once
+//released it plays on past the loop end into the rest of the table.
+//
+//the data of a note can be swapped while the sampler runs (setNoteDataPointer()).
+//a note without data starts on its resident head (setNoteHead()) and switches to the
+//full data as soon as it is published again, a voice that reaches the end of the head
+//first waits for it (a head underrun). a note with neither is dropped. every note a
+//voice or fade plays is stamped with the block count each block, so that a note cache
+//can tell when its old data is no longer referenced (see SpiNoteCache).
+namespace Tonic {
+	namespace Tonic_ {
+		class PolySampler_ : public Generator_
+		{
+		public:
+			enum EnvelopeStage { STAGE_IDLE = 0, STAGE_ATTACK, STAGE_DECAY, STAGE_SUSTAIN, STAGE_RELEASE };
+
+		protected:
+			//note tables of the module, shared by all voices
+			//SampleTable notetables_[POLYSAMPLER_NUMBEROFNOTES];
+			//note banks, bank 0 for a single module, filled at setup time only
+			vector<SampleTable> notebanks_[POLYSAMPLER_MAXNUMBEROFBANKS];
+			//note data of each bank, inside notebanks_ or owned by the caller (see the note arena)
+			const TonicFloat* volatile notedata_[POLYSAMPLER_MAXNUMBEROFBANKS][POLYSAMPLER_NUMBEROFNOTES];
+			unsigned int noteframes_[POLYSAMPLER_MAXNUMBEROFBANKS][POLYSAMPLER_NUMBEROFNOTES];
+			//first frames of notes whose data can be withdrawn, always resident, NULL for none
+			const TonicFloat* noteheaddata_[POLYSAMPLER_MAXNUMBEROFBANKS][POLYSAMPLER_NUMBEROFNOTES];
+			unsigned int noteheadframes_[POLYSAMPLER_MAXNUMBEROFBANKS][POLYSAMPLER_NUMBEROFNOTES];
+			bool bankloaded_[POLYSAMPLER_MAXNUMBEROFBANKS];
+			//peak amplitude of each note table per 1 << POLYSAMPLER_AMPLITUDESHIFT frames
+			vector< vector<TonicFloat> > noteamplitudes_[POLYSAMPLER_MAXNUMBEROFBANKS];
+			//sustain loop of each note, loop end 0 for none
+			unsigned int noteloopstart_[POLYSAMPLER_MAXNUMBEROFBANKS][POLYSAMPLER_NUMBEROFNOTES];
+			unsigned int noteloopend_[POLYSAMPLER_MAXNUMBEROFBANKS][POLYSAMPLER_NUMBEROFNOTES];
+			//blocks rendered so far, and the block count plus one of the last block each note was asked for or played in, 0 for never
+			volatile long blockcount_;
+			volatile long notelastused_[POLYSAMPLER_MAXNUMBEROFBANKS][POLYSAMPLER_NUMBEROFNOTES];
+
+			//envelope settings, in seconds except sustain level
+			TonicFloat attack_;
+			TonicFloat decay_;
+			TonicFloat sustain_;
+			TonicFloat release_;
+			TonicFloat velocitysensitivity_;
+			TonicFloat stealfade_;
+
+			//voice state, structure of arrays
+			int numberofvoices_;
+			const TonicFloat* voicedata_[POLYSAMPLER_MAXNUMBEROFVOICES];
+			unsigned int voiceframes_[POLYSAMPLER_MAXNUMBEROFVOICES];
+			unsigned int voiceplayhead_[POLYSAMPLER_MAXNUMBEROFVOICES];
+			int voicestage_[POLYSAMPLER_MAXNUMBEROFVOICES];
+			TonicFloat voicelevel_[POLYSAMPLER_MAXNUMBEROFVOICES];
+			TonicFloat voicereleasestep_[POLYSAMPLER_MAXNUMBEROFVOICES];
+			TonicFloat voicegain_[POLYSAMPLER_MAXNUMBEROFVOICES];
+			unsigned int voicestartoffset_[POLYSAMPLER_MAXNUMBEROFVOICES]; //first frame of the block the voice sounds in
+			int voicereleaseoffset_[POLYSAMPLER_MAXNUMBEROFVOICES]; //frame of the block the release starts at, -1 when none
+			const TonicFloat* voiceamplitudes_[POLYSAMPLER_MAXNUMBEROFVOICES]; //note table peaks of the voice
+			volatile TonicFloat voiceloudness_[POLYSAMPLER_MAXNUMBEROFVOICES]; //updated every block, read by the allocator
+			unsigned int voiceloopstart_[POLYSAMPLER_MAXNUMBEROFVOICES];
+			unsigned int voiceloopend_[POLYSAMPLER_MAXNUMBEROFVOICES]; //0 when the note does not loop
+			volatile long* voicelastused_[POLYSAMPLER_MAXNUMBEROFVOICES]; //notelastused_ entry of the note of the voice
+			const TonicFloat* volatile* voicenotedata_[POLYSAMPLER_MAXNUMBEROFVOICES]; //notedata_ entry of the note of the voice
+			unsigned int voiceavailable_[POLYSAMPLER_MAXNUMBEROFVOICES]; //frames of voicedata_, less than voiceframes_ while on the head
+			bool voicestalled_[POLYSAMPLER_MAXNUMBEROFVOICES]; //played through its head, waiting for the note data
+			volatile long numberofheadstarts_; //notes started on their head
+			volatile long numberofheadunderruns_; //voices that played through their head before the note data was back
+
+			//stolen voices fading out, a slot is free when fadeframesleft_ is 0
+			const TonicFloat* fadedata_[POLYSAMPLER_MAXNUMBEROFFADES];
+			unsigned int fadeframes_[POLYSAMPLER_MAXNUMBEROFFADES];
+			unsigned int fadeplayhead_[POLYSAMPLER_MAXNUMBEROFFADES];
+			unsigned int fadeframesleft_[POLYSAMPLER_MAXNUMBEROFFADES];
+			TonicFloat fadelevel_[POLYSAMPLER_MAXNUMBEROFFADES];
+			TonicFloat fadestep_[POLYSAMPLER_MAXNUMBEROFFADES];
+			volatile long* fadelastused_[POLYSAMPLER_MAXNUMBEROFFADES];
+
+			//compact list of the voices to render this block
+			int activevoices_[POLYSAMPLER_MAXNUMBEROFVOICES];
+			int numberofactivevoices_;
+
+			//requests posted by noteOn()/noteOff(), -1 when none
+			volatile long requestednote_[POLYSAMPLER_MAXNUMBEROFVOICES];
+			volatile long requestedvelocity_[POLYSAMPLER_MAXNUMBEROFVOICES];
+			volatile long requestedbank_[POLYSAMPLER_MAXNUMBEROFVOICES];
+			volatile long requestedoff_[POLYSAMPLER_MAXNUMBEROFVOICES]; //1 for a note off, 2 for a stop
+			volatile long requestedonoffset_[POLYSAMPLER_MAXNUMBEROFVOICES];
+			volatile long requestedoffoffset_[POLYSAMPLER_MAXNUMBEROFVOICES];
+
+			//bit set for every voice that reached the end of its note table, taken by the allocator
+			volatile long finishedvoices_[POLYSAMPLER_MAXNUMBEROFVOICES / 32];
+
+			//per frame envelope of the voice being rendered, duplicated for left and right
+			TonicFloat envelope_[kSynthesisBlockSize * 2];
+
+			void applyRequests();
+			void startRelease(int voice);
+			void startFade(int voice);
+			void setNoteData(int bank, const TonicFloat* const* notedata, const unsigned int* noteframes);
+			void renderFades(TonicFloat* out);
+			unsigned int renderEnvelope(int voice, unsigned int firstframe, unsigned int lastframe);
+			void computeSynthesisBlock(const SynthesisContext_ &context);
+
+		public:
+			PolySampler_();
+
+			void setNoteTables(SampleTable** tables) { setNoteBank(0, tables); }
+			void setNoteBank(int bank, SampleTable** tables);
+			//stereo interleaved note data that outlives the sampler, frames per note
+			void setNoteBank(int bank, const TonicFloat* const* data, const unsigned int* frames);
+			void setNoteLoops(int bank, const unsigned int* loopstarts, const unsigned int* loopends);
+			//replaces the data of one note of a loaded bank, same frames, NULL to withdraw the note. any thread
+			void setNoteDataPointer(int bank, int note, const TonicFloat* data);
+			//first frames of the note played while its data is withdrawn, a copy that outlives the sampler
+			void setNoteHead(int bank, int note, const TonicFloat* data, unsigned int frames);
+			long getNumberOfHeadStarts() { return numberofheadstarts_; }
+			long getNumberOfHeadUnderruns() { return numberofheadunderruns_; }
+			long getBlockCount() { return blockcount_; }
+			//block count plus one of the last block the note was played in (or asked for while without data), 0 for never
+			long getNoteLastUsed(int bank, int note) { return notelastused_[bank][note]; }
+			void setNumberOfVoices(int numberofvoices);
+			void setAttack(TonicFloat seconds) { attack_ = seconds; }
+			void setDecay(TonicFloat seconds) { decay_ = seconds; }
+			void setSustain(TonicFloat level) { sustain_ = level; }
+			void setRelease(TonicFloat seconds) { release_ = seconds; }
+			void setVelocitySensitivity(TonicFloat sensitivity) { velocitysensitivity_ = sensitivity; }
+			void setStealFade(TonicFloat seconds) { stealfade_ = seconds; }
+
+			void noteOn(int voice, int note, int velocity, int frameoffset = 0, int bank = 0);
+			void noteOff(int voice, int frameoffset = 0);
+			void stopVoice(int voice); //fades the voice out over the steal fade time instead of its release
+			bool isVoiceIdle(int voice) { return voicestage_[voice] == STAGE_IDLE && requestednote_[voice] < 0; }
+			//loudness of the voice as of the last block, a note not yet started counts as full scale
+			TonicFloat getVoiceLevel(int voice) { return (requestednote_[voice] >= 0) ? 1.0f : voiceloudness_[voice]; }
+			//moves the finished voice bits into mask (POLYSAMPLER_MAXNUMBEROFVOICES / 32 words) and clears them
+			void takeFinishedVoices(unsigned long* mask);
+		};
+	}
+
+	class PolySampler : public TemplatedGenerator<Tonic_::PolySampler_>
+	{
+	public:
+		PolySampler& setNoteTables(SampleTable** tables) { gen()->setNoteTables(tables); return *this; }
+		PolySampler& setNoteBank(int bank, SampleTable** tables) { gen()->setNoteBank(bank, tables); return *this; }
+		PolySampler& setNoteBank(int bank, const TonicFloat* const* data, const unsigned int* frames) { gen()->setNoteBank(bank, data, frames); return *this; }
+		PolySampler& setNoteLoops(int bank, const unsigned int* loopstarts, const unsigned int* loopends) { gen()->setNoteLoops(bank, loopstarts, loopends); return *this; }
+		void setNoteDataPointer(int bank, int note, const TonicFloat* data) { gen()->setNoteDataPointer(bank, note, data); }
+		PolySampler& setNoteHead(int bank, int note, const TonicFloat* data, unsigned int frames) { gen()->setNoteHead(bank, note, data, frames); return *this; }
+		long getNumberOfHeadStarts() { return gen()->getNumberOfHeadStarts(); }
+		long getNumberOfHeadUnderruns() { return gen()->getNumberOfHeadUnderruns(); }
+		long getBlockCount() { return gen()->getBlockCount(); }
+		long getNoteLastUsed(int bank, int note) { return gen()->getNoteLastUsed(bank, note); }
+		PolySampler& numberOfVoices(int numberofvoices) { gen()->setNumberOfVoices(numberofvoices); return *this; }
+		PolySampler& attack(TonicFloat seconds) { gen()->setAttack(seconds); return *this; }
+		PolySampler& decay(TonicFloat seconds) { gen()->setDecay(seconds); return *this; }
+		PolySampler& sustain(TonicFloat level) { gen()->setSustain(level); return *this; }
+		PolySampler& release(TonicFloat seconds) { gen()->setRelease(seconds); return *this; }
+		PolySampler& velocitySensitivity(TonicFloat sensitivity) { gen()->setVelocitySensitivity(sensitivity); return *this; }
+		PolySampler& stealFade(TonicFloat seconds) { gen()->setStealFade(seconds); return *this; }
+
+		void noteOn(int voice, int note, int velocity, int frameoffset = 0, int bank = 0) { gen()->noteOn(voice, note, velocity, frameoffset, bank); }
+		void noteOff(int voice, int frameoffset = 0) { gen()->noteOff(voice, frameoffset); }
+		void stopVoice(int voice) { gen()->stopVoice(voice); }
+		bool isVoiceIdle(int voice) { return gen()->isVoiceIdle(voice); }
+		TonicFloat getVoiceLevel(int voice) { return gen()->getVoiceLevel(voice); }
+		void takeFinishedVoices(unsigned long* mask) { gen()->takeFinishedVoices(mask); }
+	};
+}
+
+#endif //POLYSAMPLER_H
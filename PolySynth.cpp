@@ -36,106 +36,518 @@
 extern SuperBufferPlayer* global_psuperplayer[16]; //16 modules max, one for each midi channel
 //spi, begin
 
-void BasicPolyphonicAllocator::addVoice(Synth synth)
+//spi, begin
+#include <intrin.h> //for _BitScanForward()
+//spi, end
+
+//spi, begin
+bool BasicPolyphonicAllocator::addVoice(Synth synth)
+{
+    //addParameter() returns the existing parameter when the voice graph already declared it
+    PolyVoiceSynth voiceSynth;
+    voiceSynth.synth = synth;
+    voiceSynth.note = synth.addParameter("polyNote", 0.0);
+    voiceSynth.gate = synth.addParameter("polyGate", 0.0);
+    voiceSynth.velocity = synth.addParameter("polyVelocity", 0.0);
+    voiceSynth.voiceNumber = synth.addParameter("polyVoiceNumber", 0.0);
+    return addVoice(voiceSynth);
+}
+//spi, end
+
+//spi, begin
+void BasicPolyphonicAllocator::setSharedVoices(SuperBufferPlayer* players, SuperBufferKeymapSlot* slots, int numberOfModules)
+{
+    sharedVoices = true;
+    voicePlayers = players;
+    for (int m = 0; m < numberOfModules && m < POLYSYNTH_MAXNUMBEROFMODULES; m++)
+        keymapSlots[m] = slots ? &slots[m] : NULL;
+}
+//spi, end
+
+//spi, begin
+//void BasicPolyphonicAllocator::addVoice(Synth synth)
+bool BasicPolyphonicAllocator::addVoice(PolyVoiceSynth voiceSynth)
+//spi, end
 {
-    PolyVoice v;
-    v.synth = synth;
+    //spi, begin
+    if (voiceData == NULL || numVoices >= maxVoices)
+        return false;
+    //PolyVoice v;
+    PolyVoice& v = voiceData[numVoices];
+    //spi, end
+    //v.synth = synth;
+    //spi, begin
+    v.synth = voiceSynth.synth;
+    v.note = voiceSynth.note;
+    v.gate = voiceSynth.gate;
+    v.velocity = voiceSynth.velocity;
+    v.voiceNumber = voiceSynth.voiceNumber;
+    //spi, end
     v.currentNote = 0;
+	//spi, begin
+	v.gateOn = false;
+	v.releaseFramesLeft = 0;
+	v.playFramesLeft = 0;
+	v.playsThrough = false;
+	v.level = 0.0f;
+	v.active = false;
+	v.currentModule = 0;
+	v.notePrev = v.noteNext = -1;
+	//spi, end
 
-    inactiveVoiceQueue.push_back(voiceData.size());
-    voiceData.push_back(v);
+    //inactiveVoiceQueue.push_back(voiceData.size());
+    //voiceData.push_back(v);
+    //spi, begin
+    queuePushBack(inactiveVoiceQueue, numVoices);
+    numVoices++;
+    return true;
+    //spi, end
 }
 
-void BasicPolyphonicAllocator::noteOn(int moduleid, int note, int velocity)
+void BasicPolyphonicAllocator::noteOn(int moduleid, int note, int velocity, int frameOffset)
 {
-    int voiceNumber = getNextVoice(note);
+    //spi, begin
+    if (note < 0 || note >= POLYSYNTH_NUMBEROFNOTES || moduleid < 0 || moduleid >= POLYSYNTH_MAXNUMBEROFMODULES)
+        return;
+    reclaimFinishedVoices();
+    //int voiceNumber = getNextVoice(note);
+    int voiceNumber = getNextVoice(moduleid, note);
+    //spi, end
 
     if (voiceNumber < 0)
         return; // no voice available
 
-    cout << ">> " << "Starting note " << note << " on voice " << voiceNumber << "\n";
+    //cout << ">> " << "Starting note " << note << " on voice " << voiceNumber << "\n";
+	//spi, begin
+	if (logRing) logRing->logNote(SPILOG_NOTESTART, moduleid, note, voiceNumber);
+	//spi, end
 
     PolyVoice& voice = voiceData[voiceNumber];
 
 	//spi, begin
-	global_psuperplayer[moduleid][voiceNumber].setBuffer(note);
+	if (useSampler)
+	{
+		//sampler.noteOn(voiceNumber, note, velocity, frameOffset);
+		sampler.noteOn(voiceNumber, note, velocity, frameOffset, sharedVoices ? moduleid : 0);
+	}
+	else
+	{
+		//global_psuperplayer[moduleid][voiceNumber].setBuffer(note);
+		if (sharedVoices)
+		{
+			voicePlayers[voiceNumber].setBuffer(keymapSlots[moduleid], note); //bind the voice to the module's keymap
+			voice.playFramesLeft = voicePlayers[voiceNumber].getBufferFrames(note);
+			voice.playsThrough = oneShotModule[moduleid]; //the player loops the table, a held note keeps sounding
+		}
+		else
+		{
+			global_psuperplayer[moduleid][voiceNumber].setBuffer(note);
+			voice.playFramesLeft = global_psuperplayer[moduleid][voiceNumber].getBufferFrames(note);
+			voice.playsThrough = oneShotModule[moduleid];
+		}
+		//voice.synth.setParameter("polyNote", note);
+		//voice.synth.setParameter("polyGate", 1.0);
+		//voice.synth.setParameter("polyVelocity", velocity);
+		//voice.synth.setParameter("polyVoiceNumber", voiceNumber);
+		voice.level = 1.0f; //not rendered yet, never the quietest
+		voice.note.value(note);
+		voice.gate.value(1.0);
+		voice.velocity.value(velocity);
+		voice.voiceNumber.value(voiceNumber);
+	}
 	//spi, end
-    voice.synth.setParameter("polyNote", note);
-    voice.synth.setParameter("polyGate", 1.0);
-    voice.synth.setParameter("polyVelocity", velocity);
-    voice.synth.setParameter("polyVoiceNumber", voiceNumber);
+
+    //spi, begin
+    //a stolen voice leaves the queue and note list of the note it was playing
+    if (voice.active)
+    {
+        queueRemove(activeVoiceQueue[voice.currentModule], voiceNumber);
+        noteRemove(voiceNumber);
+    }
+    else
+    {
+        queueRemove(inactiveVoiceQueue, voiceNumber);
+    }
+    //spi, end
 
     voice.currentNote = note;
+	//spi, begin
+	voice.currentModule = moduleid;
+	voice.gateOn = true;
+	//spi, end
 
-    activeVoiceQueue.remove(voiceNumber);
-    activeVoiceQueue.push_back(voiceNumber);
-    inactiveVoiceQueue.remove(voiceNumber);
+    //activeVoiceQueue.remove(voiceNumber);
+    //activeVoiceQueue.push_back(voiceNumber);
+    //inactiveVoiceQueue.remove(voiceNumber);
+    //spi, begin
+    voice.active = true;
+    queuePushBack(activeVoiceQueue[moduleid], voiceNumber);
+    notePushBack(voiceNumber);
+    //spi, end
 }
 
-void BasicPolyphonicAllocator::noteOff(int note)
+//spi, begin
+//void BasicPolyphonicAllocator::noteOff(int note, int frameOffset)
+void BasicPolyphonicAllocator::noteOff(int moduleid, int note, int frameOffset)
+//spi, end
 {
     // clear the oldest active voice with this note number
-    for (int voiceNumber : activeVoiceQueue)
+    //spi, begin
+    //for (int voiceNumber : activeVoiceQueue)
+    if (note < 0 || note >= POLYSYNTH_NUMBEROFNOTES || moduleid < 0 || moduleid >= POLYSYNTH_MAXNUMBEROFMODULES)
+        return;
+    reclaimFinishedVoices();
+    if (oneShotModule[moduleid])
+        return; //the note plays through, the voice is freed at the end of its table
+    int voiceNumber = noteHead[moduleid][note];
+    if (voiceNumber < 0)
+        return;
+    //spi, end
     {
         PolyVoice& voice = voiceData[voiceNumber];
-        if (voice.currentNote == note)
+        //if (voice.currentNote == note)
         {
-            cout << ">> " << "Stopping note " << note << " on voice " << voiceNumber << "\n";
+            //cout << ">> " << "Stopping note " << note << " on voice " << voiceNumber << "\n";
+			//spi, begin
+			if (logRing) logRing->logNote(SPILOG_NOTESTOP, moduleid, note, voiceNumber);
+			//spi, end
 
-            voice.synth.setParameter("polyGate", 0.0);
+			//spi, begin
+			if (useSampler)
+				sampler.noteOff(voiceNumber, frameOffset);
+			else
+				voice.gate.value(0.0); //voice.synth.setParameter("polyGate", 0.0);
+			voice.releaseFramesLeft = releaseFrames;
+			voice.gateOn = false;
+			//spi, end
 
-            activeVoiceQueue.remove(voiceNumber);
-            inactiveVoiceQueue.remove(voiceNumber);
-            inactiveVoiceQueue.push_back(voiceNumber);
+            //activeVoiceQueue.remove(voiceNumber);
+            //inactiveVoiceQueue.remove(voiceNumber);
+            //inactiveVoiceQueue.push_back(voiceNumber);
+            //spi, begin
+            queueRemove(activeVoiceQueue[moduleid], voiceNumber);
+            noteRemove(voiceNumber);
+            voice.active = false;
+            queuePushBack(inactiveVoiceQueue, voiceNumber);
+            //spi, end
 
-            break;
+            //break;
         }
     }
 }
 
-int BasicPolyphonicAllocator::getNextVoice(int note)
+//spi, begin
+void BasicPolyphonicAllocator::setReleaseTime(float seconds)
+{
+	//one extra synthesis block so the envelope has reached zero before the voice is skipped
+	releaseFrames = (int)(seconds * Tonic::sampleRate()) + kSynthesisBlockSize;
+}
+
+void BasicPolyphonicAllocator::advanceVoices(int numFrames)
+{
+	for (int i = 0; i < numVoices; i++)
+	{
+		PolyVoice& voice = voiceData[i];
+		if (!voice.gateOn && voice.releaseFramesLeft > 0)
+			voice.releaseFramesLeft -= numFrames;
+		if (voice.playsThrough && voice.playFramesLeft > 0)
+		{
+			voice.playFramesLeft -= numFrames;
+			if (voice.playFramesLeft <= 0 && voice.active)
+				finishedVoices[i >> 5] |= 1UL << (i & 31); //freed on the next note event
+		}
+	}
+}
+
+void BasicPolyphonicAllocator::reclaimFinishedVoices()
+{
+	unsigned long finished[POLYSYNTH_MAXNUMBEROFVOICES / 32];
+	if (useSampler)
+	{
+		sampler.takeFinishedVoices(finished);
+	}
+	else
+	{
+		for (int i = 0; i < POLYSYNTH_MAXNUMBEROFVOICES / 32; i++)
+		{
+			finished[i] = finishedVoices[i];
+			finishedVoices[i] = 0;
+		}
+	}
+	for (int i = 0; i < POLYSYNTH_MAXNUMBEROFVOICES / 32; i++)
+	{
+		unsigned long bit;
+		while (_BitScanForward(&bit, finished[i]))
+		{
+			finished[i] &= finished[i] - 1;
+			int voiceNumber = i * 32 + (int)bit;
+			//a voice retriggered since it finished is playing its new note
+			if (voiceNumber < numVoices && voiceData[voiceNumber].active && isVoiceIdle(voiceNumber))
+				freeVoice(voiceNumber);
+		}
+	}
+}
+
+int BasicPolyphonicAllocator::getQuietestVoice(int moduleid)
+{
+	int quietestVoice = -1;
+	float quietestLevel = 0.0f;
+	for (int v = activeVoiceQueue[moduleid].head; v >= 0; v = voiceData[v].queueNext)
+	{
+		float level = getVoiceLevel(v);
+		if (quietestVoice < 0 || level < quietestLevel)
+		{
+			quietestLevel = level;
+			quietestVoice = v;
+		}
+	}
+	return quietestVoice;
+}
+
+void BasicPolyphonicAllocator::setVoiceLimit(int limit)
+{
+	voiceLimit = (limit < 1) ? 1 : limit;
+	for (int m = 0; m < POLYSYNTH_MAXNUMBEROFMODULES; m++)
+	{
+		while (activeVoiceQueue[m].size > voiceLimit)
+		{
+			int voiceNumber = getQuietestVoice(m);
+			PolyVoice& voice = voiceData[voiceNumber];
+			if (logRing) logRing->logNote(SPILOG_NOTESTOP, m, voice.currentNote, voiceNumber);
+			if (useSampler)
+			{
+				sampler.stopVoice(voiceNumber); //short fade, the cpu is needed now
+				voice.releaseFramesLeft = 0;
+			}
+			else
+			{
+				voice.gate.value(0.0); //synth graph voices have no faster way out than their release
+				voice.releaseFramesLeft = releaseFrames;
+			}
+			voice.gateOn = false;
+			queueRemove(activeVoiceQueue[m], voiceNumber);
+			noteRemove(voiceNumber);
+			voice.active = false;
+			queuePushBack(inactiveVoiceQueue, voiceNumber);
+		}
+	}
+}
+
+void BasicPolyphonicAllocator::freeVoice(int voiceNumber)
+{
+	PolyVoice& voice = voiceData[voiceNumber];
+	if (logRing) logRing->logNote(SPILOG_NOTESTOP, voice.currentModule, voice.currentNote, voiceNumber);
+	if (!useSampler)
+		voice.gate.value(0.0); //rearms the envelope for the next note
+	voice.gateOn = false;
+	voice.releaseFramesLeft = 0; //the note table has ended, there is no tail
+	queueRemove(activeVoiceQueue[voice.currentModule], voiceNumber);
+	noteRemove(voiceNumber);
+	voice.active = false;
+	queuePushBack(inactiveVoiceQueue, voiceNumber);
+}
+
+void BasicPolyphonicAllocator::queueRemove(VoiceQueue& queue, int voiceNumber)
+{
+	PolyVoice& voice = voiceData[voiceNumber];
+	if (voice.queuePrev >= 0) voiceData[voice.queuePrev].queueNext = voice.queueNext;
+	else queue.head = voice.queueNext;
+	if (voice.queueNext >= 0) voiceData[voice.queueNext].queuePrev = voice.queuePrev;
+	else queue.tail = voice.queuePrev;
+	voice.queuePrev = voice.queueNext = -1;
+	queue.size--;
+}
+
+void BasicPolyphonicAllocator::queuePushBack(VoiceQueue& queue, int voiceNumber)
+{
+	PolyVoice& voice = voiceData[voiceNumber];
+	voice.queuePrev = queue.tail;
+	voice.queueNext = -1;
+	if (queue.tail >= 0) voiceData[queue.tail].queueNext = voiceNumber;
+	else queue.head = voiceNumber;
+	queue.tail = voiceNumber;
+	queue.size++;
+}
+
+void BasicPolyphonicAllocator::noteRemove(int voiceNumber)
+{
+	PolyVoice& voice = voiceData[voiceNumber];
+	int m = voice.currentModule;
+	int note = voice.currentNote;
+	if (voice.notePrev >= 0) voiceData[voice.notePrev].noteNext = voice.noteNext;
+	else noteHead[m][note] = voice.noteNext;
+	if (voice.noteNext >= 0) voiceData[voice.noteNext].notePrev = voice.notePrev;
+	else noteTail[m][note] = voice.notePrev;
+	voice.notePrev = voice.noteNext = -1;
+	if (noteHead[m][note] < 0) activeNotes[m][note >> 5] &= ~(1UL << (note & 31));
+}
+
+void BasicPolyphonicAllocator::notePushBack(int voiceNumber)
+{
+	PolyVoice& voice = voiceData[voiceNumber];
+	int m = voice.currentModule;
+	int note = voice.currentNote;
+	voice.notePrev = noteTail[m][note];
+	voice.noteNext = -1;
+	if (noteTail[m][note] >= 0) voiceData[noteTail[m][note]].noteNext = voiceNumber;
+	else noteHead[m][note] = voiceNumber;
+	noteTail[m][note] = voiceNumber;
+	activeNotes[m][note >> 5] |= 1UL << (note & 31);
+}
+
+int BasicPolyphonicAllocator::getLowestActiveNote(int moduleid)
+{
+	for (int i = 0; i < POLYSYNTH_NUMBEROFNOTES / 32; i++)
+	{
+		unsigned long bit;
+		if (_BitScanForward(&bit, activeNotes[moduleid][i]))
+			return i * 32 + (int)bit;
+	}
+	return -1;
+}
+
+bool BasicPolyphonicAllocator::canClaimFreeVoice(int moduleid)
+{
+	if (inactiveVoiceQueue.size == 0)
+		return false;
+	int active = activeVoiceQueue[moduleid].size;
+	//if (active >= maxModuleVoices[moduleid])
+	if (active >= maxModuleVoices[moduleid] || active >= voiceLimit)
+		return false;
+	if (active < minModuleVoices[moduleid])
+		return true;
+	//above its own minimum a module leaves enough free voices for the others to reach theirs
+	int reserved = 0;
+	for (int m = 0; m < POLYSYNTH_MAXNUMBEROFMODULES; m++)
+	{
+		if (m != moduleid && activeVoiceQueue[m].size < minModuleVoices[m])
+			reserved += minModuleVoices[m] - activeVoiceQueue[m].size;
+	}
+	return inactiveVoiceQueue.size > reserved;
+}
+
+int BasicPolyphonicAllocator::getStealModule(int moduleid)
+{
+	//a module steals from itself once it holds any voice at or above its minimum, so that a
+	//busy module never takes sounding notes from the others
+	int active = activeVoiceQueue[moduleid].size;
+	if (active > 0 && active >= minModuleVoices[moduleid])
+		return moduleid;
+	//else from the module holding the most voices above its own minimum
+	int stealModule = -1;
+	int mostSurplus = 0;
+	for (int m = 0; m < POLYSYNTH_MAXNUMBEROFMODULES; m++)
+	{
+		int surplus = activeVoiceQueue[m].size - minModuleVoices[m];
+		if (m != moduleid && surplus > mostSurplus)
+		{
+			mostSurplus = surplus;
+			stealModule = m;
+		}
+	}
+	if (stealModule < 0 && active > 0)
+		return moduleid;
+	return stealModule;
+}
+//spi, end
+
+//spi, begin
+//int BasicPolyphonicAllocator::getNextVoice(int note)
+int BasicPolyphonicAllocator::getNextVoice(int moduleid, int note)
+//spi, end
 {
     // Find a voice not playing any note
-    if (inactiveVoiceQueue.size())
+    //spi, begin
+    //if (inactiveVoiceQueue.size())
+    //{
+    //    return inactiveVoiceQueue.front();
+    //}
+    if (canClaimFreeVoice(moduleid))
     {
-        return inactiveVoiceQueue.front();
+        return inactiveVoiceQueue.head;
     }
+    //spi, end
 
     return -1;
 }
 
-int OldestNoteStealingPolyphonicAllocator::getNextVoice(int note)
+//spi, begin
+//int OldestNoteStealingPolyphonicAllocator::getNextVoice(int note)
+int OldestNoteStealingPolyphonicAllocator::getNextVoice(int moduleid, int note)
+//spi, end
 {
-    int voice = BasicPolyphonicAllocator::getNextVoice(note);
+    //spi, begin
+    //int voice = BasicPolyphonicAllocator::getNextVoice(note);
+    int voice = BasicPolyphonicAllocator::getNextVoice(moduleid, note);
+    //spi, end
     if (voice >= 0)
         return voice;
 
-    if (activeVoiceQueue.size())
+    //spi, begin
+    //if (activeVoiceQueue.size())
+    //{
+    //    return activeVoiceQueue.front();
+    //}
+    int stealModule = getStealModule(moduleid);
+    if (stealModule >= 0)
     {
-        return activeVoiceQueue.front();
+        return activeVoiceQueue[stealModule].head;
     }
+    //spi, end
 
     return -1;
 }
 
-int LowestNoteStealingPolyphonicAllocator::getNextVoice(int note)
+//spi, begin
+//int LowestNoteStealingPolyphonicAllocator::getNextVoice(int note)
+int LowestNoteStealingPolyphonicAllocator::getNextVoice(int moduleid, int note)
+//spi, end
 {
-    int voice = BasicPolyphonicAllocator::getNextVoice(note);
+    //spi, begin
+    //int voice = BasicPolyphonicAllocator::getNextVoice(note);
+    int voice = BasicPolyphonicAllocator::getNextVoice(moduleid, note);
+    //spi, end
     if (voice >= 0)
         return voice;
 
     // Find the playing voice with the lowest note that's lower than the requested note
-    int lowestNote = note;
-    int lowestVoice = -1;
-    for (int voiceNumber : activeVoiceQueue)
-    {
-        PolyVoice& voice = voiceData[voiceNumber];
-        if (voice.currentNote < lowestNote)
-        {
-            lowestNote = voice.currentNote;
-            lowestVoice = voiceNumber;
-        }
-    }
+    //spi, begin
+    //int lowestNote = note;
+    //int lowestVoice = -1;
+    //for (int voiceNumber : activeVoiceQueue)
+    //{
+    //    PolyVoice& voice = voiceData[voiceNumber];
+    //    if (voice.currentNote < lowestNote)
+    //    {
+    //        lowestNote = voice.currentNote;
+    //        lowestVoice = voiceNumber;
+    //    }
+    //}
+    //return lowestVoice;
+    //the oldest voice of the lowest active note, found with the note bitmask instead of a scan
+    int stealModule = getStealModule(moduleid);
+    if (stealModule < 0)
+        return -1;
+    if (stealModule != moduleid)
+        return activeVoiceQueue[stealModule].head; //another module's notes are not compared by pitch, its oldest voice goes
+    int lowestNote = getLowestActiveNote(moduleid);
+    if (lowestNote >= 0 && lowestNote < note)
+        return noteHead[moduleid][lowestNote];
+    return -1;
+    //spi, end
+}
+
+//spi, begin
+int QuietestVoiceStealingPolyphonicAllocator::getNextVoice(int moduleid, int note)
+{
+    int voice = BasicPolyphonicAllocator::getNextVoice(moduleid, note);
+    if (voice >= 0)
+        return voice;
 
-    return lowestVoice;
-}
\ No newline at end of file
+    //the quietest active voice of the module to steal from
+    int stealModule = getStealModule(moduleid);
+    if (stealModule < 0)
+        return -1;
+    return getQuietestVoice(stealModule);
+}
+//spi, end
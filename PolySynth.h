@@ -30,21 +30,315 @@
 //
 
 #include "Tonic.h"
+//spi, begin
+#include "SummingBus.h"
+#include "PolySampler.h"
+#include "spilogring.h"
+//spi, end
 
 using namespace Tonic;
 
-template<typename VoiceAllocator>
+//spi, begin
+#define POLYSYNTH_MAXNUMBEROFVOICES	POLYSAMPLER_MAXNUMBEROFVOICES //default capacity of a PolySynthWithAllocator
+#define POLYSYNTH_NUMBEROFNOTES		128
+#define POLYSYNTH_MAXNUMBEROFMODULES	16 //sampler modules that can share the voices of one allocator
+
+class SuperBufferPlayer;
+class SuperBufferKeymapSlot;
+//spi, end
+
+//spi, begin
+// A voice synth with its control parameters resolved once. The allocator writes
+// through these handles on note events, no parameter name lookup on the event path.
+class PolyVoiceSynth
+{
+public:
+    Synth synth;
+    ControlParameter note; //"polyNote"
+    ControlParameter gate; //"polyGate"
+    ControlParameter velocity; //"polyVelocity"
+    ControlParameter voiceNumber; //"polyVoiceNumber"
+};
+//spi, end
+
+class BasicPolyphonicAllocator
+{
+public:
+    class PolyVoice
+    {
+    public:
+        int currentNote;
+        Synth synth;
+        //spi, begin
+        int currentModule; //module whose note bank the voice plays
+        ControlParameter note;
+        ControlParameter gate;
+        ControlParameter velocity;
+        ControlParameter voiceNumber;
+        bool gateOn;
+        int releaseFramesLeft; //frames of envelope tail still sounding after gate off
+        int playFramesLeft; //frames of the note table left to play (synth graph voices)
+        bool playsThrough; //one-shot note, freed at the end of its table; the buffer players loop, other notes last until released
+        float level; //peak of the voice's last rendered block (synth graph voices)
+        bool active; //in the active queue, else in the inactive queue
+        int queuePrev; //links within the active or inactive queue, -1 at the ends
+        int queueNext;
+        int notePrev; //links within the active voices of currentModule holding currentNote, oldest first
+        int noteNext;
+        //spi, end
+    };
+
+    //spi, begin
+    //index-linked queue threaded through the PolyVoice links, O(1) insert and remove
+    class VoiceQueue
+    {
+    public:
+        VoiceQueue() : head(-1), tail(-1), size(0) {}
+        int head;
+        int tail;
+        int size;
+    };
+
+    BasicPolyphonicAllocator() : voiceData(NULL), numVoices(0), maxVoices(0), releaseFrames(kSynthesisBlockSize), useSampler(false), logRing(NULL), sharedVoices(false), voicePlayers(NULL), voiceLimit(POLYSYNTH_MAXNUMBEROFVOICES)
+    {
+        for (int m = 0; m < POLYSYNTH_MAXNUMBEROFMODULES; m++)
+        {
+            for (int i = 0; i < POLYSYNTH_NUMBEROFNOTES; i++)
+                noteHead[m][i] = noteTail[m][i] = -1;
+            for (int i = 0; i < POLYSYNTH_NUMBEROFNOTES / 32; i++)
+                activeNotes[m][i] = 0;
+            minModuleVoices[m] = 0;
+            maxModuleVoices[m] = POLYSYNTH_MAXNUMBEROFVOICES;
+            keymapSlots[m] = NULL;
+            oneShotModule[m] = false;
+        }
+        for (int i = 0; i < POLYSYNTH_MAXNUMBEROFVOICES / 32; i++)
+            finishedVoices[i] = 0;
+    }
+
+    // The voices live in fixed storage provided by the owner (see PolySynthWithAllocator),
+    // note events never allocate and every queue operation is O(1).
+    void setVoiceStorage(PolyVoice* storage, int capacity) { voiceData = storage; maxVoices = capacity; }
+
+    // One set of voices for several modules (global voice pool). A voice is bound at noteOn
+    // to the note bank of the module that claimed it: bank moduleid of the native sampler,
+    // or the keymap of slots[moduleid] loaded into players[voice] for synth graph voices.
+    void setSharedVoices(SuperBufferPlayer* players, SuperBufferKeymapSlot* slots, int numberOfModules);
+    // Voices a module is guaranteed (taken from the free voices first) and can hold at most
+    void setModuleQuota(int moduleid, int minVoices, int maxVoices)
+    {
+        minModuleVoices[moduleid] = minVoices;
+        maxModuleVoices[moduleid] = maxVoices;
+    }
+    int getNumberOfActiveVoices(int moduleid) { return activeVoiceQueue[moduleid].size; }
+    // Polyphony cap applied to every module on top of its quota, lowered under cpu load.
+    // Voices over a lowered cap are stopped at once, the quietest first.
+    void setVoiceLimit(int limit);
+    // One-shot modules ignore noteOff, their voices are freed when the note table has played
+    // through (or when stolen). A native sampler voice reaching the end of its table is freed at once
+    // anyway; the synth graph players loop their table, so only one-shot notes end there.
+    void setModuleOneShot(int moduleid, bool oneShot) { oneShotModule[moduleid] = oneShot; }
+    //spi, end
+
+    //spi, begin
+    //void addVoice(Synth synth);
+    bool addVoice(PolyVoiceSynth voiceSynth); //false once the storage is full
+    bool addVoice(Synth synth); //resolves the poly parameters by name, once
+    //spi, end
+    //spi, begin
+    //frameOffset places the event within the next synthesis block (native sampler only)
+    void noteOn(int moduleid, int noteNumber, int velocity, int frameOffset = 0);
+    //void noteOff(int noteNumber, int frameOffset = 0);
+    void noteOff(int moduleid, int noteNumber, int frameOffset = 0);
+    //spi, end
+
+    //spi, begin
+    void setReleaseTime(float seconds);
+    void setSampler(PolySampler polysampler) { sampler = polysampler; useSampler = true; }
+    void setLogRing(SpiLogRing* ring) { logRing = ring; }
+    bool isVoiceIdle(int voiceNumber)
+    {
+        if (useSampler)
+            return sampler.isVoiceIdle(voiceNumber);
+        const PolyVoice& voice = voiceData[voiceNumber];
+        //return !voice.gateOn && voice.releaseFramesLeft <= 0;
+        return (!voice.gateOn && voice.releaseFramesLeft <= 0) || (voice.playsThrough && voice.playFramesLeft <= 0);
+    }
+    // Loudness of the voice, 0 when silent, updated once per block. The native sampler measures it
+    // from the envelope and the note table peaks; for a synth graph voice it is the peak of the
+    // block the mixer rendered (envelope, velocity and sample included), full scale until the
+    // first block of a new note is rendered.
+    float getVoiceLevel(int voiceNumber)
+    {
+        if (useSampler)
+            return sampler.getVoiceLevel(voiceNumber);
+        const PolyVoice& voice = voiceData[voiceNumber];
+        if (voice.playsThrough && voice.playFramesLeft <= 0)
+            return 0.0f;
+        return voice.level;
+    }
+    void setVoicePeak(int voiceNumber, float peak) { voiceData[voiceNumber].level = peak; }
+    bool hasActiveVoices()
+    {
+        for (int i = 0; i < numVoices; i++)
+        {
+            if (!isVoiceIdle(i))
+                return true;
+        }
+        return false;
+    }
+    void advanceVoices(int numFrames);
+    //spi, end
+
+protected:
+    //spi, begin
+    //virtual int getNextVoice(int note);
+    virtual int getNextVoice(int moduleid, int note);
+    //spi, end
+    //spi, begin
+    //vector<PolyVoice> voiceData;
+    PolyVoice* voiceData;
+    int numVoices;
+    int maxVoices;
+    //spi, end
+    //spi, begin
+    int releaseFrames;
+    bool useSampler; //voices are rendered by the native sampler instead of per voice synths
+    PolySampler sampler;
+    SpiLogRing* logRing; //note start/stop records, NULL for no logging
+    bool sharedVoices;
+    SuperBufferPlayer* voicePlayers; //graph voice players of shared voices, NULL for the native sampler
+    SuperBufferKeymapSlot* keymapSlots[POLYSYNTH_MAXNUMBEROFMODULES];
+    int minModuleVoices[POLYSYNTH_MAXNUMBEROFMODULES];
+    int maxModuleVoices[POLYSYNTH_MAXNUMBEROFMODULES];
+    bool oneShotModule[POLYSYNTH_MAXNUMBEROFMODULES];
+    int voiceLimit;
+    unsigned long finishedVoices[POLYSYNTH_MAXNUMBEROFVOICES / 32]; //synth graph voices that played their note table through
+    //spi, end
+    //spi, begin
+    //list<int> inactiveVoiceQueue;
+    //list<int> activeVoiceQueue;
+    VoiceQueue inactiveVoiceQueue; //free voices, least recently released first
+    VoiceQueue activeVoiceQueue[POLYSYNTH_MAXNUMBEROFMODULES]; //voices with their gate on per module, oldest note first
+    int noteHead[POLYSYNTH_MAXNUMBEROFMODULES][POLYSYNTH_NUMBEROFNOTES]; //oldest active voice per note, -1 for none
+    int noteTail[POLYSYNTH_MAXNUMBEROFMODULES][POLYSYNTH_NUMBEROFNOTES];
+    unsigned long activeNotes[POLYSYNTH_MAXNUMBEROFMODULES][POLYSYNTH_NUMBEROFNOTES / 32]; //bit set for every note with an active voice
+
+    void queueRemove(VoiceQueue& queue, int voiceNumber);
+    void queuePushBack(VoiceQueue& queue, int voiceNumber);
+    void noteRemove(int voiceNumber);
+    void notePushBack(int voiceNumber);
+    void reclaimFinishedVoices(); //frees the active voices whose note table has ended
+    void freeVoice(int voiceNumber); //active voice back to the inactive queue
+    int getQuietestVoice(int moduleid); //the quietest active voice of the module, the oldest on a tie, -1 for none
+    int getLowestActiveNote(int moduleid); //-1 when no voice of the module is active
+    bool canClaimFreeVoice(int moduleid); //a free voice exists and the quotas let the module take it
+    int getStealModule(int moduleid); //module to steal a voice from when none can be claimed, -1 for none
+    //spi, end
+};
+
+class OldestNoteStealingPolyphonicAllocator : public BasicPolyphonicAllocator
+{
+protected:
+    //spi, begin
+    //virtual int getNextVoice(int note);
+    virtual int getNextVoice(int moduleid, int note);
+    //spi, end
+};
+
+class LowestNoteStealingPolyphonicAllocator : public BasicPolyphonicAllocator
+{
+protected:
+    //spi, begin
+    //virtual int getNextVoice(int note);
+    virtual int getNextVoice(int moduleid, int note);
+    //spi, end
+};
+
+//spi, begin
+// Steals the quietest voice instead of the oldest or the lowest, a decayed tail goes before a
+// freshly struck note. With the native sampler the stolen voice is faded out over a few
+// milliseconds (PolySampler::stealFade()) rather than cut.
+class QuietestVoiceStealingPolyphonicAllocator : public BasicPolyphonicAllocator
+{
+protected:
+    virtual int getNextVoice(int moduleid, int note);
+};
+//spi, end
+
+//spi, begin
+// Mixer that only ticks the voices the allocator reports as sounding.
+// A voice is idle once its gate is off and its release tail has elapsed;
+// when every voice of the module is idle the whole block is skipped.
+namespace Tonic {
+    namespace Tonic_ {
+        class PolyMixer_ : public SummingBus_
+        {
+        protected:
+            BasicPolyphonicAllocator* allocator_;
+
+            bool isInputActive(unsigned int inputindex)
+            {
+                return !allocator_->isVoiceIdle(inputindex);
+            }
+
+            //the voice level the quietest voice stealing compares, at control rate
+            void inputRendered(unsigned int inputindex, TonicFrames& frames)
+            {
+                allocator_->setVoicePeak(inputindex, SummingBusPeak(frames.dataPointer(), frames.size()));
+            }
+
+        public:
+            PolyMixer_() : allocator_(NULL) {}
+
+            void setAllocator(BasicPolyphonicAllocator* allocator) { allocator_ = allocator; }
+
+            void computeSynthesisBlock(const SynthesisContext_ &context)
+            {
+                if (allocator_ == NULL || !allocator_->hasActiveVoices())
+                {
+                    outputFrames_.clear();
+                    return; // module bypassed, nothing sounding
+                }
+                SummingBus_::computeSynthesisBlock(context);
+                allocator_->advanceVoices(kSynthesisBlockSize);
+            }
+        };
+    }
+
+    class PolyMixer : public TemplatedGenerator<Tonic_::PolyMixer_>
+    {
+    public:
+        PolyMixer& setAllocator(BasicPolyphonicAllocator* allocator) { gen()->setAllocator(allocator); return *this; }
+        PolyMixer& addInput(BufferFiller input, TonicFloat gain = 1.0f) { gen()->addInput(input, gain); return *this; }
+    };
+}
+//spi, end
+
+//spi, begin
+//template<typename VoiceAllocator>
+//MaxVoices is the fixed voice capacity, the allocator never allocates after construction
+template<typename VoiceAllocator, int MaxVoices = POLYSYNTH_MAXNUMBEROFVOICES>
+//spi, end
 class PolySynthWithAllocator : public Synth
 {
 public:
     PolySynthWithAllocator() : Synth() 
     {
+        //spi, begin
+        allocator.setVoiceStorage(voiceStorage, MaxVoices);
+        mixer.setAllocator(&allocator);
+        //spi, end
         setOutputGen(mixer); 
     }
 
     void addVoice(Synth synth)
     {
-        allocator.addVoice(synth);
+        //spi, begin
+        //allocator.addVoice(synth);
+        if (!allocator.addVoice(synth))
+            return; // MaxVoices reached
+        //spi, end
         mixer.addInput(synth);
     }
 
@@ -55,52 +349,103 @@ public:
             addVoice(createFn());
     }
 
-    void noteOn(int moduleid, int note, int velocity)
+    //spi, begin
+    void addVoice(PolyVoiceSynth voiceSynth)
     {
-        allocator.noteOn(moduleid, note, velocity);
+        if (!allocator.addVoice(voiceSynth))
+            return; // MaxVoices reached
+        mixer.addInput(voiceSynth.synth);
     }
 
-    void noteOff(int note)
+    typedef PolyVoiceSynth (PolyVoiceCreateFn)();
+    void addVoices(PolyVoiceCreateFn createFn, int count)
     {
-        allocator.noteOff(note);
+        for (int i = 0; i < count; i++)
+            addVoice(createFn());
     }
+    //spi, end
 
-protected:
-    Mixer mixer;
-    VoiceAllocator allocator;
-};
+    //spi, begin
+    void noteOn(int moduleid, int note, int velocity, int frameOffset = 0)
+    {
+        allocator.noteOn(moduleid, note, velocity, frameOffset);
+    }
 
-class BasicPolyphonicAllocator
-{
-public:
-    class PolyVoice
+    void noteOff(int moduleid, int note, int frameOffset = 0)
     {
-    public:
-        int currentNote;
-        Synth synth;
-    };
+        allocator.noteOff(moduleid, note, frameOffset);
+    }
+    //spi, end
 
-    void addVoice(Synth synth);
-    void noteOn(int moduleid, int noteNumber, int velocity);
-    void noteOff(int noteNumber);
+    //spi, begin
+    void setReleaseTime(float seconds)
+    {
+        allocator.setReleaseTime(seconds);
+    }
 
-protected:
-    virtual int getNextVoice(int note);
-    vector<PolyVoice> voiceData;
-    list<int> inactiveVoiceQueue;
-    list<int> activeVoiceQueue;
-};
+    bool hasActiveVoices()
+    {
+        return allocator.hasActiveVoices();
+    }
 
-class OldestNoteStealingPolyphonicAllocator : public BasicPolyphonicAllocator
-{
-protected:
-    virtual int getNextVoice(int note);
-};
+    bool isVoiceIdle(int voiceNumber)
+    {
+        return allocator.isVoiceIdle(voiceNumber);
+    }
+
+    void setLogRing(SpiLogRing* ring)
+    {
+        allocator.setLogRing(ring);
+    }
+
+    // Voices shared by several modules, see BasicPolyphonicAllocator::setSharedVoices()
+    void setSharedVoices(SuperBufferPlayer* players, SuperBufferKeymapSlot* slots, int numberOfModules)
+    {
+        allocator.setSharedVoices(players, slots, numberOfModules);
+    }
+
+    void setModuleQuota(int moduleid, int minVoices, int maxVoices)
+    {
+        allocator.setModuleQuota(moduleid, minVoices, maxVoices);
+    }
+
+    int getNumberOfActiveVoices(int moduleid)
+    {
+        return allocator.getNumberOfActiveVoices(moduleid);
+    }
+
+    void setModuleOneShot(int moduleid, bool oneShot)
+    {
+        allocator.setModuleOneShot(moduleid, oneShot);
+    }
+
+    void setVoiceLimit(int limit)
+    {
+        allocator.setVoiceLimit(limit);
+    }
+
+    // Render the voices with the native sampler instead of one synth graph per voice
+    void setSampler(PolySampler sampler, int count)
+    {
+        if (count > MaxVoices)
+            count = MaxVoices;
+        sampler.numberOfVoices(count);
+        allocator.setSampler(sampler);
+        for (int i = 0; i < count; i++)
+            allocator.addVoice(PolyVoiceSynth()); //parameters unused, the sampler takes the note events
+        setOutputGen(sampler);
+    }
+    //spi, end
 
-class LowestNoteStealingPolyphonicAllocator : public BasicPolyphonicAllocator
-{
 protected:
-    virtual int getNextVoice(int note);
+    //spi, begin
+    //Mixer mixer;
+    PolyMixer mixer;
+    //spi, end
+    VoiceAllocator allocator;
+    //spi, begin
+    BasicPolyphonicAllocator::PolyVoice voiceStorage[MaxVoices];
+    //spi, end
 };
 
 typedef PolySynthWithAllocator<LowestNoteStealingPolyphonicAllocator> PolySynth;
@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef SUMMINGBUS_H
+#define SUMMINGBUS_H
+
+#include "Tonic.h"
+#include <xmmintrin.h> //for sse
+#include <math.h>
+#include "spirenderpool.h"
+
+using namespace Tonic;
+
+//out[i] = in[i]*gain, or out[i] += in[i]*gain when accumulating, 4 floats per step
+inline void SummingBusMix(TonicFloat* out, const TonicFloat* in, TonicFloat gain, unsigned int count, bool accumulate)
+{
+	unsigned int i = 0;
+	__m128 g = _mm_set1_ps(gain);
+	if (accumulate)
+	{
+		for (; i + 4 <= count; i += 4)
+		{
+			_mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(_mm_loadu_ps(in + i), g)));
+		}
+		for (; i < count; i++) out[i] += in[i] * gain;
+	}
+	else
+	{
+		for (; i + 4 <= count; i += 4)
+		{
+			_mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(in + i), g));
+		}
+		for (; i < count; i++) out[i] = in[i] * gain;
+	}
+}
+
+//largest absolute sample of a block, 4 floats per step
+inline TonicFloat SummingBusPeak(const TonicFloat* in, unsigned int count)
+{
+	unsigned int i = 0;
+	__m128 signmask = _mm_set1_ps(-0.0f);
+	__m128 peak4 = _mm_setzero_ps();
+	for (; i + 4 <= count; i += 4)
+	{
+		peak4 = _mm_max_ps(peak4, _mm_andnot_ps(signmask, _mm_loadu_ps(in + i)));
+	}
+	TonicFloat peaks[4];
+	_mm_storeu_ps(peaks, peak4);
+	TonicFloat peak = 0.0f;
+	for (int j = 0; j < 4; j++) if (peaks[j] > peak) peak = peaks[j];
+	for (; i < count; i++) if (fabsf(in[i]) > peak) peak = fabsf(in[i]);
+	return peak;
+}
+
+//flat N-input summing bus with a gain per input, replaces chains of binary Adders.
+//serially each input is ticked into one work buffer and mixed straight into the output.
+//with a render pool each input is ticked into its own block buffer as a pool job,
+//then all buffers are mixed on the calling (audio) thread once the fork-join completes.
+namespace Tonic {
+	namespace Tonic_ {
+		class SummingBus_ : public Generator_
+		{
+		protected:
+			vector<BufferFiller> inputs_;
+			vector<TonicFloat> gains_;
+			vector<TonicFrames> inputFrames_;
+			vector<char> inputRendered_;
+			TonicFrames workSpace_;
+			SpiRenderPool* pool_;
+			const SynthesisContext_* context_;
+
+			//inputs reported inactive are neither ticked nor mixed
+			virtual bool isInputActive(unsigned int inputindex) { return true; }
+			//called with each input's block once it is ticked, on the thread that ticked it
+			virtual void inputRendered(unsigned int inputindex, TonicFrames& frames) {}
+
+			static void renderInput(void* userdata, int inputindex)
+			{
+				SummingBus_* bus = (SummingBus_*)userdata;
+				bus->inputRendered_[inputindex] = bus->isInputActive(inputindex);
+				if (bus->inputRendered_[inputindex])
+				{
+					bus->inputs_[inputindex].tick(bus->inputFrames_[inputindex], *(bus->context_));
+					bus->inputRendered(inputindex, bus->inputFrames_[inputindex]);
+				}
+			}
+
+		public:
+			SummingBus_() : pool_(NULL), context_(NULL)
+			{
+				setIsStereoOutput(true);
+				workSpace_.resize(kSynthesisBlockSize, 2, 0);
+			}
+
+			void addInput(BufferFiller input, TonicFloat gain)
+			{
+				inputs_.push_back(input);
+				gains_.push_back(gain);
+				inputFrames_.push_back(TonicFrames(kSynthesisBlockSize, 2));
+				inputRendered_.push_back(0);
+			}
+
+			void setGain(unsigned int inputindex, TonicFloat gain) { gains_[inputindex] = gain; }
+			void setRenderPool(SpiRenderPool* pool) { pool_ = pool; }
+
+			void computeSynthesisBlock(const SynthesisContext_ &context)
+			{
+				TonicFloat* out = outputFrames_.dataPointer();
+				unsigned int count = outputFrames_.size();
+				bool accumulate = false;
+				if (pool_)
+				{
+					context_ = &context;
+					pool_->run(renderInput, this, (int)inputs_.size());
+					for (unsigned int i = 0; i < inputs_.size(); i++)
+					{
+						if (!inputRendered_[i]) continue;
+						SummingBusMix(out, inputFrames_[i].dataPointer(), gains_[i], count, accumulate);
+						accumulate = true;
+					}
+				}
+				else
+				{
+					for (unsigned int i = 0; i < inputs_.size(); i++)
+					{
+						if (!isInputActive(i)) continue;
+						inputs_[i].tick(workSpace_, context);
+						inputRendered(i, workSpace_);
+						SummingBusMix(out, workSpace_.dataPointer(), gains_[i], count, accumulate);
+						accumulate = true;
+					}
+				}
+				if (!accumulate) outputFrames_.clear();
+			}
+		};
+	}
+
+	class SummingBus : public TemplatedGenerator<Tonic_::SummingBus_>
+	{
+	public:
+		SummingBus& addInput(BufferFiller input, TonicFloat gain = 1.0f) { gen()->addInput(input, gain); return *this; }
+		SummingBus& setGain(unsigned int inputindex, TonicFloat gain) { gen()->setGain(inputindex, gain); return *this; }
+		SummingBus& setRenderPool(SpiRenderPool* pool) { gen()->setRenderPool(pool); return *this; }
+	};
+}
+
+#endif //SUMMINGBUS_H
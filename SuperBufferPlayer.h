@@ -1,7 +1,7 @@
-
 #ifndef SUPERBUFFERPLAYER_H
 #define SUPERBUFFERPLAYER_H
 
+#include <windows.h> //for InterlockedIncrement() and InterlockedExchangePointer()
 #include "Tonic.h"
 
 using namespace Tonic;
@@ -9,11 +9,148 @@ using namespace Tonic;
 
 #define SUPERBUFFERPLAYER_NUMBEROFBUFFERS	128
 
-class SuperBufferPlayer : public BufferPlayer{
+//the note tables of a module, one per midi note. built once and never modified,
+//refcounted so that one keymap can be shared by several slots.
+class SuperBufferKeymap
+{
 protected:
 	SampleTable _pbuffers[SUPERBUFFERPLAYER_NUMBEROFBUFFERS];
+	volatile LONG _refcount;
+	~SuperBufferKeymap() {}
+public:
+	SuperBufferKeymap(SampleTable** pbuffers) : _refcount(1)
+	{
+		for (int i = 0; i < SUPERBUFFERPLAYER_NUMBEROFBUFFERS; i++)
+		{
+			_pbuffers[i] = *(pbuffers[i]);
+		}
+	};
+
+	SampleTable& getBuffer(int midinotenumber) { return _pbuffers[midinotenumber]; };
+
+	void retain() { InterlockedIncrement(&_refcount); };
+	void release() { if (InterlockedDecrement(&_refcount) == 0) delete this; };
+};
+
+//the current keymap of a module, all of the module's voices read their notes through
+//it so that replacing the keymap of every voice is one pointer swap. replace() posts
+//the new keymap from a control thread, the audio thread takes it with update() at a
+//block boundary and holds the old one until every player bound to it has moved onto
+//the new one (each player stamps the generation it bound), then hands it back to be
+//released by collect(), replace() or clear(). tonic's table refcounts are not atomic,
+//so the old tables are only ever released once no voice of the audio thread holds
+//them, and a new keymap must not share tables with the one it replaces. nothing is
+//allocated or freed on the audio thread.
+class SuperBufferKeymapSlot
+{
+protected:
+	SuperBufferKeymap* volatile _pkeymap;
+	SuperBufferKeymap* volatile _ppending;
+	SuperBufferKeymap* volatile _pheld; //replaced, some players still hold its tables
+	SuperBufferKeymap* volatile _pretired; //replaced and no longer held, for the control thread to release
+	LONG _generation; //bumped by every swap, audio thread
+	int _numberofplayers; //players bound to the current keymap, audio thread
+	int _numberofheldplayers; //players still bound to _pheld, audio thread
+public:
+	SuperBufferKeymapSlot() : _pkeymap(NULL), _ppending(NULL), _pheld(NULL), _pretired(NULL), _generation(0), _numberofplayers(0), _numberofheldplayers(0) {};
+	~SuperBufferKeymapSlot() { clear(); };
+
+	SuperBufferKeymap* getKeymap() { return _pkeymap; };
+	LONG getGeneration() { return _generation; };
+	bool isReplacing() { return _pheld != NULL; }; //audio thread, players still have to move off the old keymap
+
+	//takes over the caller's reference, before the audio starts
+	void setKeymap(SuperBufferKeymap* pkeymap)
+	{
+		clear();
+		_pkeymap = pkeymap;
+	};
+
+	//control thread, takes over the caller's reference
+	void replace(SuperBufferKeymap* pkeymap)
+	{
+		collect();
+		SuperBufferKeymap* ppending = (SuperBufferKeymap*)InterlockedExchangePointer((void* volatile*)&_ppending, pkeymap);
+		if (ppending) ppending->release(); //replaced before the audio thread took it
+	};
+
+	//control thread, releases the old keymap once the audio thread handed it back. true when
+	//the last replace() is complete: swapped in and the old keymap released
+	bool collect()
+	{
+		bool complete = (_ppending == NULL && _pheld == NULL); //read before taking _pretired, see update()
+		SuperBufferKeymap* pretired = (SuperBufferKeymap*)InterlockedExchangePointer((void* volatile*)&_pretired, NULL);
+		if (pretired) pretired->release();
+		return complete;
+	};
+
+	//audio thread, between two synthesis blocks
+	void update()
+	{
+		if (_ppending == NULL || _pheld != NULL || _pretired != NULL) return; //the previous keymap is not released yet, next block
+		//_pheld is set before _ppending is cleared, collect() never sees neither while a swap is under way.
+		//only this thread clears _ppending so the exchange returns the keymap seen above
+		_pheld = _pkeymap;
+		SuperBufferKeymap* pkeymap = (SuperBufferKeymap*)InterlockedExchangePointer((void* volatile*)&_ppending, NULL);
+		_pkeymap = pkeymap;
+		_generation++;
+		_numberofheldplayers = _numberofplayers;
+		_numberofplayers = 0;
+		if (_numberofheldplayers == 0) handBack();
+	};
+
+	//audio thread (or before the audio starts), a player bound its generator to a table of the
+	//current keymap, after letting go of its previous table
+	void bind() { _numberofplayers++; };
+	void unbind(LONG generation)
+	{
+		if (generation == _generation)
+			_numberofplayers--;
+		else if (generation == _generation - 1 && _pheld != NULL && --_numberofheldplayers == 0)
+			handBack(); //the last player of the old keymap moved off it
+	};
+
+	//releases every keymap, once the audio is stopped
+	void clear()
+	{
+		if (_pkeymap) _pkeymap->release();
+		if (_ppending) _ppending->release();
+		if (_pheld) _pheld->release();
+		if (_pretired) _pretired->release();
+		_pkeymap = _ppending = _pheld = _pretired = NULL;
+		_generation++; //players still stamped with the cleared keymap are not counted
+		_numberofplayers = _numberofheldplayers = 0;
+	};
+
+protected:
+	void handBack()
+	{
+		InterlockedExchangePointer((void* volatile*)&_pretired, _pheld);
+		_pheld = NULL;
+	};
+};
+
+class SuperBufferPlayer : public BufferPlayer{
+protected:
+	//SampleTable _pbuffers[SUPERBUFFERPLAYER_NUMBEROFBUFFERS];
+	SuperBufferKeymapSlot* _pkeymapslot; //shared by all of the module's voices
+	SuperBufferKeymapSlot* _pboundslot; //slot whose keymap holds the generator's table
+	LONG _boundgeneration; //generation of _pboundslot's keymap when the table was bound
+
+	SuperBufferPlayer& bindBuffer(int midinotenumber)
+	{
+		//the generator lets go of its previous table first, its keymap is released once unbound
+		gen()->setBuffer(_pkeymapslot->getKeymap()->getBuffer(midinotenumber));
+		if (_pboundslot) _pboundslot->unbind(_boundgeneration);
+		_pboundslot = _pkeymapslot;
+		_boundgeneration = _pkeymapslot->getGeneration();
+		_pkeymapslot->bind();
+		return *this;
+	};
 public:
+	SuperBufferPlayer() : _pkeymapslot(NULL), _pboundslot(NULL), _boundgeneration(0) {};
 
+	/*
 	SuperBufferPlayer& setBuffers(SampleTable** pbuffers)
 	{
 		for (int i = 0; i < SUPERBUFFERPLAYER_NUMBEROFBUFFERS; i++)
@@ -23,19 +160,44 @@ public:
 		gen()->setBuffer(_pbuffers[0]);
 		return *this;
 	};
+	*/
+
+	SuperBufferPlayer& setKeymapSlot(SuperBufferKeymapSlot* pkeymapslot)
+	{
+		_pkeymapslot = pkeymapslot;
+		return bindBuffer(0);
+	};
 
 	SuperBufferPlayer& setBuffer(ControlParameter midinotenumber)
 	{
-		gen()->setBuffer(_pbuffers[(int)(midinotenumber.getValue())]);
-		return *this;
+		return bindBuffer((int)(midinotenumber.getValue()));
 	};
 
 	SuperBufferPlayer& setBuffer(int midinotenumber)
 	{
-		gen()->setBuffer(_pbuffers[midinotenumber]);
-		return *this;
+		return bindBuffer(midinotenumber);
+	};
+
+	//length of a note, for the allocator to free the voice once the note has played
+	unsigned int getBufferFrames(int midinotenumber)
+	{
+		return _pkeymapslot->getKeymap()->getBuffer(midinotenumber).frames();
+	};
+
+	//plays a note of any module's keymap, for the voices of the global voice pool
+	SuperBufferPlayer& setBuffer(SuperBufferKeymapSlot* pkeymapslot, int midinotenumber)
+	{
+		_pkeymapslot = pkeymapslot;
+		return setBuffer(midinotenumber);
+	};
+
+	//audio thread, true while the generator holds a table of a replaced keymap. an idle
+	//voice is moved onto the current keymap with setBuffer(0)
+	bool isOnReplacedKeymap()
+	{
+		return _pboundslot != NULL && _boundgeneration != _pboundslot->getGeneration();
 	};
 
 };
 
-#endif //SUPERBUFFERPLAYER_H
\ No newline at end of file
+#endif //SUPERBUFFERPLAYER_H
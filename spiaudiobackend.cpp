@@ -0,0 +1,345 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "stdafx.h"
+#include <mmsystem.h> //for timeBeginPeriod()
+#include <string.h>
+
+#include "spiaudiobackend.h"
+
+#define SPIAUDIO_SLEEPMARGIN_S	0.002 //sleep until this close to the deadline, then spin
+#define SPIAUDIO_FILERING_S		2.0 //audio the wav file ring holds, covers a slow disk write
+#define SPIAUDIO_FILEPOLL_MS	10 //writer thread period
+
+
+/////////////////////////
+//portaudio output stream
+/////////////////////////
+
+SpiPortAudioBackend::SpiPortAudioBackend(const PaStreamParameters* outputparameters)
+{
+	parameters = *outputparameters;
+	stream = NULL;
+	callback = NULL;
+	userdata = NULL;
+}
+
+SpiPortAudioBackend::~SpiPortAudioBackend()
+{
+	close();
+}
+
+int SpiPortAudioBackend::PortAudioCallback(const void* inputBuffer, void* outputBuffer, unsigned long framesPerBuffer,
+	const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags, void* userData)
+{
+	SpiPortAudioBackend* pBackend = (SpiPortAudioBackend*)userData;
+	unsigned int statusflags = 0;
+	if (statusFlags & paOutputUnderflow) statusflags |= SPIAUDIO_OUTPUTUNDERFLOW;
+	if (statusFlags & (paInputUnderflow | paInputOverflow | paOutputUnderflow | paOutputOverflow)) statusflags |= SPIAUDIO_XRUN;
+	int result = pBackend->callback((float*)outputBuffer, framesPerBuffer, statusflags, pBackend->userdata);
+	return (result == SPIAUDIO_CONTINUE) ? paContinue : paAbort;
+}
+
+bool SpiPortAudioBackend::open(double samplerate, unsigned long framesperbuffer, int numberofchannels, SpiAudioCallback callback, void* userdata)
+{
+	this->callback = callback;
+	this->userdata = userdata;
+	parameters.channelCount = numberofchannels;
+	parameters.sampleFormat = paFloat32;
+	PaError err = Pa_OpenStream(
+		&stream,
+		NULL, //no input
+		&parameters,
+		samplerate,
+		framesperbuffer,
+		0, //paClipOff,      // we won't output out of range samples so don't bother clipping them
+		PortAudioCallback,
+		this);
+	if (err != paNoError)
+	{
+		lasterror = string("Unable to open stream: ") + Pa_GetErrorText(err);
+		stream = NULL;
+		return false;
+	}
+	return true;
+}
+
+bool SpiPortAudioBackend::start()
+{
+	PaError err = Pa_StartStream(stream);
+	if (err != paNoError)
+	{
+		lasterror = string("Unable to start stream: ") + Pa_GetErrorText(err);
+		return false;
+	}
+	return true;
+}
+
+bool SpiPortAudioBackend::stop()
+{
+	if (stream == NULL) return true;
+	PaError err = Pa_StopStream(stream);
+	if (err != paNoError)
+	{
+		lasterror = string("Error stopping stream: ") + Pa_GetErrorText(err);
+		return false;
+	}
+	return true;
+}
+
+void SpiPortAudioBackend::close()
+{
+	if (stream == NULL) return;
+	PaError err = Pa_CloseStream(stream);
+	if (err != paNoError) lasterror = string("Error closing stream: ") + Pa_GetErrorText(err);
+	stream = NULL;
+}
+
+double SpiPortAudioBackend::getOutputLatency()
+{
+	const PaStreamInfo* pStreamInfo = (stream != NULL) ? Pa_GetStreamInfo(stream) : NULL;
+	return (pStreamInfo != NULL) ? pStreamInfo->outputLatency : 0.0;
+}
+
+
+//////////////////////////
+//clock driven null device
+//////////////////////////
+
+SpiNullAudioBackend::SpiNullAudioBackend()
+{
+	samplerate = 0.0;
+	framesperbuffer = 0;
+	numberofchannels = 0;
+	callback = NULL;
+	userdata = NULL;
+	buffer = NULL;
+	hThread = NULL;
+	quit = 0;
+}
+
+SpiNullAudioBackend::~SpiNullAudioBackend()
+{
+	stop();
+	close();
+}
+
+bool SpiNullAudioBackend::open(double samplerate, unsigned long framesperbuffer, int numberofchannels, SpiAudioCallback callback, void* userdata)
+{
+	this->samplerate = samplerate;
+	this->framesperbuffer = framesperbuffer;
+	this->numberofchannels = numberofchannels;
+	this->callback = callback;
+	this->userdata = userdata;
+	buffer = new float[framesperbuffer * numberofchannels];
+	return true;
+}
+
+bool SpiNullAudioBackend::start()
+{
+	if (hThread != NULL) return true;
+	quit = 0;
+	hThread = CreateThread(NULL, 0, ThreadProc, this, 0, NULL);
+	if (hThread == NULL)
+	{
+		lasterror = "Unable to create the null device thread";
+		return false;
+	}
+	SetThreadPriority(hThread, THREAD_PRIORITY_TIME_CRITICAL);
+	return true;
+}
+
+bool SpiNullAudioBackend::stop()
+{
+	if (hThread == NULL) return true;
+	InterlockedExchange(&quit, 1);
+	WaitForSingleObject(hThread, INFINITE);
+	CloseHandle(hThread);
+	hThread = NULL;
+	return true;
+}
+
+void SpiNullAudioBackend::close()
+{
+	delete[] buffer;
+	buffer = NULL;
+}
+
+DWORD WINAPI SpiNullAudioBackend::ThreadProc(LPVOID lpParam)
+{
+	((SpiNullAudioBackend*)lpParam)->run();
+	return 0;
+}
+
+void SpiNullAudioBackend::run()
+{
+	timeBeginPeriod(1); //1 ms sleep granularity
+	LARGE_INTEGER frequency, now;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&now);
+	double period_s = framesperbuffer / samplerate;
+	double start_s = (double)now.QuadPart / (double)frequency.QuadPart;
+	long long block = 0;
+	unsigned int statusflags = 0;
+	while (quit == 0)
+	{
+		int result = callback(buffer, framesperbuffer, statusflags, userdata);
+		onBlock(buffer, framesperbuffer);
+		if (result != SPIAUDIO_CONTINUE) break;
+
+		//wait for the deadline of this block, that is when the device would ask for the next one
+		block++;
+		double deadline_s = start_s + block * period_s;
+		QueryPerformanceCounter(&now);
+		double now_s = (double)now.QuadPart / (double)frequency.QuadPart;
+		statusflags = (now_s > deadline_s) ? (SPIAUDIO_OUTPUTUNDERFLOW | SPIAUDIO_XRUN) : 0;
+		while (now_s < deadline_s && quit == 0)
+		{
+			if (deadline_s - now_s > SPIAUDIO_SLEEPMARGIN_S) Sleep(1);
+			else YieldProcessor();
+			QueryPerformanceCounter(&now);
+			now_s = (double)now.QuadPart / (double)frequency.QuadPart;
+		}
+	}
+	timeEndPeriod(1);
+}
+
+
+//////////////////////
+//wav file sink device
+//////////////////////
+
+SpiFileAudioBackend::SpiFileAudioBackend(const string& filename)
+{
+	this->filename = filename;
+	ring = NULL;
+	ringframes = 0;
+	writeframe = 0;
+	readframe = 0;
+	droppedframes = 0;
+	hWriterThread = NULL;
+	writerquit = 0;
+}
+
+SpiFileAudioBackend::~SpiFileAudioBackend()
+{
+	stop();
+	close();
+}
+
+bool SpiFileAudioBackend::open(double samplerate, unsigned long framesperbuffer, int numberofchannels, SpiAudioCallback callback, void* userdata)
+{
+	file = SndfileHandle(filename, SFM_WRITE, SF_FORMAT_WAV | SF_FORMAT_FLOAT, numberofchannels, (int)samplerate);
+	if (file.error())
+	{
+		lasterror = "Unable to create wav file " + filename;
+		return false;
+	}
+	ringframes = (long)(SPIAUDIO_FILERING_S * samplerate) + (long)framesperbuffer; //one slot is kept empty
+	ring = new float[ringframes * numberofchannels];
+	writeframe = 0;
+	readframe = 0;
+	droppedframes = 0;
+	return SpiNullAudioBackend::open(samplerate, framesperbuffer, numberofchannels, callback, userdata);
+}
+
+bool SpiFileAudioBackend::start()
+{
+	if (hWriterThread == NULL)
+	{
+		writerquit = 0;
+		hWriterThread = CreateThread(NULL, 0, WriterThreadProc, this, 0, NULL);
+		if (hWriterThread == NULL)
+		{
+			lasterror = "Unable to create the wav file writer thread";
+			return false;
+		}
+	}
+	return SpiNullAudioBackend::start();
+}
+
+bool SpiFileAudioBackend::stop()
+{
+	bool result = SpiNullAudioBackend::stop();
+	if (hWriterThread != NULL)
+	{
+		//the render thread is stopped, the writer drains what is left and exits
+		InterlockedExchange(&writerquit, 1);
+		WaitForSingleObject(hWriterThread, INFINITE);
+		CloseHandle(hWriterThread);
+		hWriterThread = NULL;
+	}
+	return result;
+}
+
+void SpiFileAudioBackend::close()
+{
+	file = SndfileHandle(); //closes the file
+	delete[] ring;
+	ring = NULL;
+	SpiNullAudioBackend::close();
+}
+
+//render thread, no i/o
+void SpiFileAudioBackend::onBlock(const float* output, unsigned long numberofframes)
+{
+	long write = writeframe;
+	long space = (readframe - write - 1 + ringframes) % ringframes;
+	long count = (long)numberofframes;
+	if (count > space)
+	{
+		InterlockedExchangeAdd(&droppedframes, count - space);
+		count = space;
+	}
+	long first = (count < ringframes - write) ? count : ringframes - write;
+	memcpy(ring + write * numberofchannels, output, first * numberofchannels * sizeof(float));
+	memcpy(ring, output + first * numberofchannels, (count - first) * numberofchannels * sizeof(float));
+	InterlockedExchange(&writeframe, (write + count) % ringframes); //publishes the copied frames
+}
+
+DWORD WINAPI SpiFileAudioBackend::WriterThreadProc(LPVOID lpParam)
+{
+	((SpiFileAudioBackend*)lpParam)->write();
+	return 0;
+}
+
+void SpiFileAudioBackend::write()
+{
+	while (writerquit == 0)
+	{
+		if (drain() == 0) Sleep(SPIAUDIO_FILEPOLL_MS);
+	}
+	while (drain() > 0) {}
+}
+
+long SpiFileAudioBackend::drain()
+{
+	long read = readframe;
+	long write = writeframe;
+	if (read == write) return 0;
+	long count = (write > read) ? write - read : ringframes - read; //up to the end of the ring, the rest on the next call
+	file.writef(ring + read * numberofchannels, count);
+	InterlockedExchange(&readframe, (read + count) % ringframes);
+	return count;
+}
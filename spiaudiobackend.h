@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _SPIAUDIOBACKEND_H
+#define _SPIAUDIOBACKEND_H
+
+#include <windows.h>
+#include <string>
+#include "portaudio.h"
+#include <sndfile.hh>
+
+using namespace std;
+
+#define SPIAUDIO_CONTINUE	0
+#define SPIAUDIO_ABORT		1
+
+#define SPIAUDIO_OUTPUTUNDERFLOW	0x1 //the previous block reached the device too late
+#define SPIAUDIO_XRUN				0x2 //any under or overflow reported by the device
+
+//block callback, fills numberofframes interleaved float frames, returns SPIAUDIO_CONTINUE or SPIAUDIO_ABORT
+typedef int (*SpiAudioCallback)(float* output, unsigned long numberofframes, unsigned int statusflags, void* userdata);
+
+//audio output device abstraction, the render engine only sees the block callback
+class SpiAudioBackend
+{
+public:
+	virtual ~SpiAudioBackend() {}
+
+	virtual bool open(double samplerate, unsigned long framesperbuffer, int numberofchannels, SpiAudioCallback callback, void* userdata) = 0;
+	virtual bool start() = 0;
+	virtual bool stop() = 0;
+	virtual void close() = 0;
+	virtual double getOutputLatency() = 0; //seconds
+	virtual const char* getName() = 0;
+
+	const char* getLastError() { return lasterror.c_str(); }
+
+protected:
+	string lasterror;
+};
+
+//portaudio output stream, asio channel selectors included. portaudio must be
+//initialized and the device selected in outputparameters before open().
+class SpiPortAudioBackend : public SpiAudioBackend
+{
+public:
+	SpiPortAudioBackend(const PaStreamParameters* outputparameters);
+	~SpiPortAudioBackend();
+
+	bool open(double samplerate, unsigned long framesperbuffer, int numberofchannels, SpiAudioCallback callback, void* userdata);
+	bool start();
+	bool stop();
+	void close();
+	double getOutputLatency();
+	const char* getName() { return "portaudio"; }
+
+private:
+	static int PortAudioCallback(const void* inputBuffer, void* outputBuffer, unsigned long framesPerBuffer,
+		const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags, void* userData);
+
+	PaStreamParameters parameters;
+	PaStream* stream;
+	SpiAudioCallback callback;
+	void* userdata;
+};
+
+//no device, a time critical thread calls back once per block at the real rate, paced
+//by the performance counter. a block that ends past its deadline is reported as an
+//underflow on the next call, like a device would.
+class SpiNullAudioBackend : public SpiAudioBackend
+{
+public:
+	SpiNullAudioBackend();
+	~SpiNullAudioBackend();
+
+	bool open(double samplerate, unsigned long framesperbuffer, int numberofchannels, SpiAudioCallback callback, void* userdata);
+	bool start();
+	bool stop();
+	void close();
+	double getOutputLatency() { return (samplerate > 0.0) ? framesperbuffer / samplerate : 0.0; }
+	const char* getName() { return "null"; }
+
+protected:
+	virtual void onBlock(const float* output, unsigned long numberofframes) {} //after each callback, off the callback's clock
+
+	double samplerate;
+	unsigned long framesperbuffer;
+	int numberofchannels;
+
+private:
+	static DWORD WINAPI ThreadProc(LPVOID lpParam);
+	void run();
+
+	SpiAudioCallback callback;
+	void* userdata;
+	float* buffer;
+	HANDLE hThread;
+	volatile LONG quit;
+};
+
+//null backend that also writes every block to a wav file. the render thread only
+//copies each block into a ring, a writer thread drains it to the file so that the
+//render is timed like the real callback. frames that find the ring full are dropped
+//and counted.
+class SpiFileAudioBackend : public SpiNullAudioBackend
+{
+public:
+	SpiFileAudioBackend(const string& filename);
+	~SpiFileAudioBackend();
+
+	bool open(double samplerate, unsigned long framesperbuffer, int numberofchannels, SpiAudioCallback callback, void* userdata);
+	bool start();
+	bool stop();
+	void close();
+	const char* getName() { return "file"; }
+	long getNumberOfDroppedFrames() { return droppedframes; }
+
+protected:
+	void onBlock(const float* output, unsigned long numberofframes);
+
+private:
+	static DWORD WINAPI WriterThreadProc(LPVOID lpParam);
+	void write();
+	long drain(); //writes the frames in the ring to the file, returns how many
+
+	string filename;
+	SndfileHandle file;
+	float* ring;
+	long ringframes;
+	volatile LONG writeframe; //next frame written by the render thread, modulo ringframes
+	volatile LONG readframe;  //next frame written to the file by the writer thread, modulo ringframes
+	volatile LONG droppedframes;
+	HANDLE hWriterThread;
+	volatile LONG writerquit;
+};
+
+#endif //_SPIAUDIOBACKEND_H
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _SPIDENORMAL_H
+#define _SPIDENORMAL_H
+
+#include <xmmintrin.h>
+
+//mxcsr bits, flush to zero (results) and denormals are zero (inputs)
+#define SPIDENORMAL_FTZ		0x8000
+#define SPIDENORMAL_DAZ		0x0040
+
+//level of the signal added to feedback paths by the anti-denormal option, about -360 dBFS,
+//far below audibility but large enough that a decaying tail never becomes denormal
+#define SPIDENORMAL_ANTIDENORMAL	1.0e-18f
+
+//decaying tails in delay and reverb feedback loops and filter states end up as denormal
+//floats, which x86 processes many times slower than normal ones. the render threads set
+//FTZ/DAZ so those values are flushed to zero instead. the mxcsr is per thread, call this
+//on every thread that renders, the audio thread included (at each callback, some drivers
+//call it on threads whose mxcsr they do not keep). returns the previous mxcsr.
+inline unsigned int SpiDenormal_DisableOnThisThread()
+{
+	unsigned int previous = _mm_getcsr();
+	_mm_setcsr(previous | SPIDENORMAL_FTZ | SPIDENORMAL_DAZ);
+	return previous;
+}
+
+inline void SpiDenormal_Restore(unsigned int mxcsr)
+{
+	_mm_setcsr(mxcsr);
+}
+
+inline bool SpiDenormal_IsDisabledOnThisThread()
+{
+	return (_mm_getcsr() & (SPIDENORMAL_FTZ | SPIDENORMAL_DAZ)) == (SPIDENORMAL_FTZ | SPIDENORMAL_DAZ);
+}
+
+#endif //_SPIDENORMAL_H
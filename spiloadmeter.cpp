@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "stdafx.h"
+
+#include "spiloadmeter.h"
+
+SpiLoadMeter::SpiLoadMeter()
+{
+	LARGE_INTEGER myLARGE_INTEGER;
+	QueryPerformanceFrequency(&myLARGE_INTEGER);
+	frequency = myLARGE_INTEGER.QuadPart;
+	reset();
+}
+
+void SpiLoadMeter::reset()
+{
+	blockstart = 0;
+	numberofblocks = 0;
+	numberofmisseddeadlines = 0;
+	numberofxruns = 0;
+	numberofunderflows = 0;
+	load = 0.0;
+	lastblockload = 0.0;
+	totalbusy_s = 0.0;
+	totaldeadline_s = 0.0;
+	worstload = 0.0;
+	worstduration_ms = 0.0;
+	worstblock = -1;
+	for (int i = 0; i < SPILOADMETER_NUMBEROFBUCKETS; i++) histogram[i] = 0;
+}
+
+void SpiLoadMeter::beginBlock()
+{
+	LARGE_INTEGER myLARGE_INTEGER;
+	QueryPerformanceCounter(&myLARGE_INTEGER);
+	blockstart = myLARGE_INTEGER.QuadPart;
+}
+
+void SpiLoadMeter::endBlock(unsigned long numberofframes, double samplerate, bool outputunderflow, bool xrun)
+{
+	LARGE_INTEGER myLARGE_INTEGER;
+	QueryPerformanceCounter(&myLARGE_INTEGER);
+	double duration_s = (double)(myLARGE_INTEGER.QuadPart - blockstart) / (double)frequency;
+	double deadline_s = numberofframes / samplerate;
+	double blockload = (deadline_s > 0.0) ? duration_s / deadline_s : 0.0;
+
+	int bucket = (int)(blockload * (SPILOADMETER_NUMBEROFBUCKETS - 1));
+	if (bucket >= SPILOADMETER_NUMBEROFBUCKETS) bucket = SPILOADMETER_NUMBEROFBUCKETS - 1;
+	histogram[bucket]++;
+	if (blockload >= 1.0) numberofmisseddeadlines++;
+	if (xrun) numberofxruns++;
+	if (outputunderflow) numberofunderflows++;
+
+	load = (numberofblocks == 0) ? blockload : load + SPILOADMETER_SMOOTHING * (blockload - load);
+	lastblockload = blockload;
+	totalbusy_s += duration_s;
+	totaldeadline_s += deadline_s;
+	if (blockload > worstload)
+	{
+		worstload = blockload;
+		worstduration_ms = duration_s * 1000.0;
+		worstblock = numberofblocks;
+	}
+	numberofblocks++;
+}
+
+void SpiLoadMeter::format(char* text, int size)
+{
+	_snprintf(text, size, "dsp load %.1f%% (avg %.1f%%, worst %.1f%%), %d missed deadlines, %d xruns, %d underflows\n",
+		getLoad(), getAverageLoad(), getWorstLoad(), (int)numberofmisseddeadlines, (int)numberofxruns, (int)numberofunderflows);
+	text[size - 1] = '\0';
+}
+
+void SpiLoadMeter::report(FILE* pFILE)
+{
+	if (pFILE == NULL) return;
+	fprintf(pFILE, "blocks: %d\n", (int)numberofblocks);
+	fprintf(pFILE, "dsp load: %.2f%% smoothed, %.2f%% average\n", getLoad(), getAverageLoad());
+	fprintf(pFILE, "worst block: #%d, %.3f ms, %.2f%% of its deadline\n", (int)worstblock, worstduration_ms, getWorstLoad());
+	fprintf(pFILE, "missed deadlines: %d\n", (int)numberofmisseddeadlines);
+	fprintf(pFILE, "xruns: %d, output underflows: %d\n", (int)numberofxruns, (int)numberofunderflows);
+	fprintf(pFILE, "block duration histogram, percent of the deadline:\n");
+	for (int i = 0; i < SPILOADMETER_NUMBEROFBUCKETS; i++)
+	{
+		int percent = i * 100 / (SPILOADMETER_NUMBEROFBUCKETS - 1);
+		if (i < SPILOADMETER_NUMBEROFBUCKETS - 1)
+			fprintf(pFILE, "  %3d-%3d%%: %d\n", percent, percent + 100 / (SPILOADMETER_NUMBEROFBUCKETS - 1), (int)histogram[i]);
+		else
+			fprintf(pFILE, "  >=%3d%%: %d\n", percent, (int)histogram[i]);
+	}
+	fflush(pFILE);
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _SPILOADMETER_H
+#define _SPILOADMETER_H
+
+#include <windows.h>
+#include <stdio.h>
+
+#define SPILOADMETER_NUMBEROFBUCKETS	21 //5% of the deadline per bucket, the last one for missed deadlines
+#define SPILOADMETER_SMOOTHING			0.05 //weight of the newest block in the smoothed load
+
+//audio callback load meter. beginBlock()/endBlock() bracket the callback and time
+//it with the performance counter against the block's deadline (frames/samplerate).
+//the audio thread is the only writer, readers on other threads get a snapshot that
+//may be one block stale.
+class SpiLoadMeter
+{
+public:
+	SpiLoadMeter();
+
+	void reset();
+	void beginBlock();
+	void endBlock(unsigned long numberofframes, double samplerate, bool outputunderflow, bool xrun);
+
+	double getLoad() { return load * 100.0; } //smoothed dsp load, percent of the deadline
+	double getBlockLoad() { return lastblockload * 100.0; } //dsp load of the last block, percent of the deadline
+	double getAverageLoad() { return (totaldeadline_s > 0.0) ? totalbusy_s / totaldeadline_s * 100.0 : 0.0; }
+	double getWorstLoad() { return worstload * 100.0; }
+	long getNumberOfBlocks() { return numberofblocks; }
+	long getNumberOfMissedDeadlines() { return numberofmisseddeadlines; }
+	long getNumberOfXruns() { return numberofxruns; }
+	long getNumberOfUnderflows() { return numberofunderflows; }
+
+	void format(char* text, int size); //one status line
+	void report(FILE* pFILE); //counters and histogram
+
+private:
+	LONGLONG frequency;
+	LONGLONG blockstart;
+
+	volatile long numberofblocks;
+	volatile long numberofmisseddeadlines; //callback took longer than its buffer lasts
+	volatile long numberofxruns; //any under or overflow flagged by the audio driver
+	volatile long numberofunderflows; //output underflows flagged by the audio driver
+	volatile double load;
+	volatile double lastblockload;
+	double totalbusy_s;
+	double totaldeadline_s;
+	volatile double worstload;
+	double worstduration_ms;
+	long worstblock;
+	volatile long histogram[SPILOADMETER_NUMBEROFBUCKETS];
+};
+
+#endif //_SPILOADMETER_H
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "stdafx.h"
+
+#include "spilogring.h"
+
+SpiLogRing::SpiLogRing()
+{
+	for (int i = 0; i < SPILOGRING_SIZE; i++)
+	{
+		slots[i].sequence = i;
+	}
+	writeindex = 0;
+	readindex = 0;
+	droppedrecords = 0;
+	enabled = true;
+}
+
+bool SpiLogRing::push(const SpiLogRecord& record)
+{
+	LONG position = writeindex;
+	Slot* slot;
+	while (true)
+	{
+		slot = &slots[position & (SPILOGRING_SIZE - 1)];
+		LONG difference = slot->sequence - position;
+		if (difference == 0)
+		{
+			//slot free for this position, try to reserve it
+			LONG previous = InterlockedCompareExchange(&writeindex, position + 1, position);
+			if (previous == position) break;
+			position = previous;
+		}
+		else if (difference < 0)
+		{
+			//consumer has not released the slot yet, ring full
+			InterlockedIncrement(&droppedrecords);
+			return false;
+		}
+		else
+		{
+			position = writeindex; //another producer took it
+		}
+	}
+	slot->record = record;
+	MemoryBarrier(); //the record is written before it is published
+	slot->sequence = position + 1;
+	return true;
+}
+
+bool SpiLogRing::pop(SpiLogRecord& record)
+{
+	Slot* slot = &slots[readindex & (SPILOGRING_SIZE - 1)];
+	if (slot->sequence != readindex + 1) return false;
+	MemoryBarrier(); //the record is read after its publication was seen
+	record = slot->record;
+	MemoryBarrier(); //the record is copied before the slot is handed back
+	slot->sequence = readindex + SPILOGRING_SIZE;
+	readindex++;
+	return true;
+}
+
+void SpiLogRing::logMidiMessage(long message, long timestamp)
+{
+#if SPILOG_ENABLED
+	if (!enabled) return;
+	SpiLogRecord record;
+	record.type = SPILOG_MIDIMESSAGE;
+	record.message = message;
+	record.timestamp = timestamp;
+	record.module = 0;
+	record.note = 0;
+	record.voice = 0;
+	push(record);
+#endif
+}
+
+void SpiLogRing::logNote(int type, int module, int note, int voice)
+{
+#if SPILOG_ENABLED
+	if (!enabled) return;
+	SpiLogRecord record;
+	record.type = type;
+	record.message = 0;
+	record.timestamp = 0;
+	record.module = (short)module;
+	record.note = (short)note;
+	record.voice = (short)voice;
+	push(record);
+#endif
+}
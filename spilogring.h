@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _SPILOGRING_H
+#define _SPILOGRING_H
+
+#include <windows.h>
+
+//set to 0 to compile out all the monitoring records
+#ifndef SPILOG_ENABLED
+#define SPILOG_ENABLED	1
+#endif
+
+#define SPILOGRING_SIZE	1024 //must be a power of two
+
+#define SPILOG_MIDIMESSAGE	0 //message is a PmMessage for the midi monitor
+#define SPILOG_NOTESTART	1
+#define SPILOG_NOTESTOP		2
+
+struct SpiLogRecord
+{
+	int type; //SPILOG_MIDIMESSAGE, SPILOG_NOTESTART or SPILOG_NOTESTOP
+	long message;
+	long timestamp; //porttime milliseconds for midi messages
+	short module;
+	short note;
+	short voice;
+};
+
+//fixed size, allocation free ring of binary log records. the hot paths (midi thread
+//and audio thread) only copy a record in, the formatting and display is done by a
+//low priority consumer that drains the ring at its own pace. multiple producers,
+//one consumer; each slot carries a sequence number so that producers reserve slots
+//with a compare exchange and never wait on each other. when the ring is full the
+//record is dropped and counted.
+class SpiLogRing
+{
+public:
+	SpiLogRing();
+
+	void setEnabled(bool enable) { enabled = enable; }
+	bool isEnabled() { return enabled; }
+
+	bool push(const SpiLogRecord& record); //any thread
+	bool pop(SpiLogRecord& record); //consumer thread only, false when empty
+	long getNumberOfDroppedRecords() { return droppedrecords; }
+
+	void logMidiMessage(long message, long timestamp);
+	void logNote(int type, int module, int note, int voice);
+
+private:
+	struct Slot
+	{
+		volatile LONG sequence;
+		SpiLogRecord record;
+	};
+	Slot slots[SPILOGRING_SIZE];
+	volatile LONG writeindex;
+	LONG readindex;
+	volatile LONG droppedrecords;
+	volatile bool enabled;
+};
+
+#endif //_SPILOGRING_H
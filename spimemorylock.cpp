@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "stdafx.h"
+
+#include "spimemorylock.h"
+
+size_t SpiMemoryLock_Prefault(const void* p, size_t bytes)
+{
+	if (p == NULL || bytes == 0) return 0;
+	SYSTEM_INFO mySYSTEM_INFO;
+	GetSystemInfo(&mySYSTEM_INFO);
+	const volatile char* bytep = (const volatile char*)p;
+	char sum = 0;
+	for (size_t i = 0; i < bytes; i += mySYSTEM_INFO.dwPageSize)
+	{
+		sum += bytep[i];
+	}
+	sum += bytep[bytes - 1];
+	(void)sum;
+	return bytes;
+}
+
+bool SpiMemoryLock_Lock(void* p, size_t bytes)
+{
+	if (p == NULL || bytes == 0) return false;
+	SIZE_T minimumworkingset;
+	SIZE_T maximumworkingset;
+	if (!GetProcessWorkingSetSize(GetCurrentProcess(), &minimumworkingset, &maximumworkingset)) return false;
+	if (!SetProcessWorkingSetSize(GetCurrentProcess(), minimumworkingset + bytes, maximumworkingset + bytes)) return false;
+	return VirtualLock(p, bytes) != 0;
+}
+
+void SpiMemoryLock_Unlock(void* p, size_t bytes)
+{
+	if (p == NULL || bytes == 0) return;
+	VirtualUnlock(p, bytes);
+}
+
+static bool SpiMemoryLock_EnableLockMemoryPrivilege()
+{
+	HANDLE hToken;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken)) return false;
+	TOKEN_PRIVILEGES myTOKEN_PRIVILEGES;
+	myTOKEN_PRIVILEGES.PrivilegeCount = 1;
+	myTOKEN_PRIVILEGES.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	bool enabled = false;
+	if (LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &myTOKEN_PRIVILEGES.Privileges[0].Luid))
+	{
+		AdjustTokenPrivileges(hToken, FALSE, &myTOKEN_PRIVILEGES, 0, NULL, NULL);
+		enabled = (GetLastError() == ERROR_SUCCESS); //ERROR_NOT_ALL_ASSIGNED when the user lacks the right
+	}
+	CloseHandle(hToken);
+	return enabled;
+}
+
+void* SpiMemoryLock_AllocateLargePages(size_t bytes, size_t* pallocated)
+{
+	*pallocated = 0;
+	SIZE_T largepagesize = GetLargePageMinimum();
+	if (largepagesize == 0 || bytes == 0) return NULL;
+	static bool privilegeenabled = SpiMemoryLock_EnableLockMemoryPrivilege();
+	if (!privilegeenabled) return NULL;
+	size_t allocated = (bytes + largepagesize - 1) / largepagesize * largepagesize;
+	void* p = VirtualAlloc(NULL, allocated, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+	if (p) *pallocated = allocated;
+	return p;
+}
+
+void SpiMemoryLock_FreeLargePages(void* p)
+{
+	if (p) VirtualFree(p, 0, MEM_RELEASE);
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _SPIMEMORYLOCK_H
+#define _SPIMEMORYLOCK_H
+
+#include <windows.h>
+
+//keeps sample memory resident so the audio thread never page faults on a note's first
+//play. pages are touched once after load, then optionally locked into the working set.
+
+//reads one byte of every page in the range, returns the number of bytes touched
+size_t SpiMemoryLock_Prefault(const void* p, size_t bytes);
+
+//locks the range in physical memory, growing the process minimum working set by its size
+//first (VirtualLock fails past the working set minimum)
+bool SpiMemoryLock_Lock(void* p, size_t bytes);
+void SpiMemoryLock_Unlock(void* p, size_t bytes);
+
+//large pages need the "lock pages in memory" user right (SeLockMemoryPrivilege). they are
+//never paged out. returns NULL when large pages are not available, the caller then falls
+//back to a regular allocation. *pallocated is the size rounded up to the large page size.
+void* SpiMemoryLock_AllocateLargePages(size_t bytes, size_t* pallocated);
+void SpiMemoryLock_FreeLargePages(void* p);
+
+#endif //_SPIMEMORYLOCK_H
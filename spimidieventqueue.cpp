@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "stdafx.h"
+
+#include "spimidieventqueue.h"
+
+SpiMidiEventQueue::SpiMidiEventQueue()
+{
+	writeindex = 0;
+	readindex = 0;
+	droppedevents = 0;
+}
+
+bool SpiMidiEventQueue::push(const SpiMidiEvent& event)
+{
+	LONG write = writeindex;
+	if (write - readindex >= SPIMIDIEVENTQUEUE_SIZE)
+	{
+		InterlockedIncrement(&droppedevents);
+		return false;
+	}
+	events[write & (SPIMIDIEVENTQUEUE_SIZE - 1)] = event;
+	MemoryBarrier(); //the event is written before it is published
+	writeindex = write + 1;
+	return true;
+}
+
+bool SpiMidiEventQueue::peek(SpiMidiEvent& event)
+{
+	LONG read = readindex;
+	if (read == writeindex) return false;
+	MemoryBarrier(); //the event is read after its publication was seen
+	event = events[read & (SPIMIDIEVENTQUEUE_SIZE - 1)];
+	return true;
+}
+
+void SpiMidiEventQueue::pop()
+{
+	MemoryBarrier(); //the event is consumed before its slot is handed back
+	readindex = readindex + 1;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _SPIMIDIEVENTQUEUE_H
+#define _SPIMIDIEVENTQUEUE_H
+
+#include <windows.h>
+
+#define SPIMIDIEVENTQUEUE_SIZE	1024 //must be a power of two
+
+#define SPIMIDIEVENT_NOTEOFF	0
+#define SPIMIDIEVENT_NOTEON		1
+
+struct SpiMidiEvent
+{
+	long timestamp; //porttime milliseconds, as stamped by portmidi
+	unsigned char type; //SPIMIDIEVENT_NOTEOFF or SPIMIDIEVENT_NOTEON
+	unsigned char module; //sampler module the event is for
+	unsigned char note;
+	unsigned char velocity;
+};
+
+//single producer, single consumer ring of note events. the midi thread pushes,
+//the audio thread peeks and pops inside the render callback, so the synth graph
+//is only ever touched by the audio thread. fixed size and allocation free, when
+//the ring is full the event is dropped and counted.
+class SpiMidiEventQueue
+{
+public:
+	SpiMidiEventQueue();
+
+	bool push(const SpiMidiEvent& event); //producer thread only
+	bool peek(SpiMidiEvent& event); //consumer thread only, false when empty
+	void pop(); //consumer thread only, after a successful peek()
+	long getNumberOfDroppedEvents() { return droppedevents; }
+
+private:
+	SpiMidiEvent events[SPIMIDIEVENTQUEUE_SIZE];
+	volatile LONG writeindex; //written by the producer only
+	volatile LONG readindex;  //written by the consumer only
+	volatile LONG droppedevents;
+};
+
+#endif //_SPIMIDIEVENTQUEUE_H
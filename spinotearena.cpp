@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "stdafx.h"
+
+#include <malloc.h> //for _aligned_malloc()
+
+#include "spinotearena.h"
+#include "spimemorylock.h"
+
+SpiNoteArena::SpiNoteArena()
+{
+	arena = NULL;
+	size = 0;
+	largepages = false;
+	locked = false;
+}
+
+SpiNoteArena::~SpiNoteArena()
+{
+	release();
+}
+
+bool SpiNoteArena::allocate(const unsigned int* frames, int numberofnotes, int channels, bool largepages)
+{
+	release();
+
+	//each note rounded up to the alignment so that the next one starts aligned too
+	const size_t floatsperalignment = SPINOTEARENA_ALIGNMENT / sizeof(float);
+	vector<size_t> offsets(numberofnotes);
+	size_t floats = 0;
+	for (int i = 0; i < numberofnotes; i++)
+	{
+		offsets[i] = floats;
+		floats += (frames[i] * channels + floatsperalignment - 1) / floatsperalignment * floatsperalignment;
+	}
+	if (floats == 0) floats = floatsperalignment;
+
+	size_t allocated = 0;
+	if (largepages)
+	{
+		//large pages are aligned far beyond SPINOTEARENA_ALIGNMENT
+		arena = (float*)SpiMemoryLock_AllocateLargePages(floats * sizeof(float), &allocated);
+		this->largepages = (arena != NULL);
+	}
+	if (arena == NULL)
+	{
+		arena = (float*)_aligned_malloc(floats * sizeof(float), SPINOTEARENA_ALIGNMENT);
+		if (arena == NULL) return false;
+	}
+	size = floats * sizeof(float);
+	notedata.resize(numberofnotes);
+	noteframes.resize(numberofnotes);
+	for (int i = 0; i < numberofnotes; i++)
+	{
+		notedata[i] = arena + offsets[i];
+		noteframes[i] = frames[i];
+	}
+	return true;
+}
+
+void SpiNoteArena::release()
+{
+	if (locked) SpiMemoryLock_Unlock(arena, size);
+	if (arena)
+	{
+		if (largepages) SpiMemoryLock_FreeLargePages(arena);
+		else _aligned_free(arena);
+	}
+	arena = NULL;
+	size = 0;
+	largepages = false;
+	locked = false;
+	notedata.clear();
+	noteframes.clear();
+}
+
+size_t SpiNoteArena::prefault()
+{
+	return SpiMemoryLock_Prefault(arena, size);
+}
+
+bool SpiNoteArena::lock()
+{
+	if (largepages || locked) return true;
+	locked = SpiMemoryLock_Lock(arena, size);
+	return locked;
+}
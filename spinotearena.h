@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _SPINOTEARENA_H
+#define _SPINOTEARENA_H
+
+#include <vector>
+
+using namespace std;
+
+#define SPINOTEARENA_ALIGNMENT	64 //cache line, every note starts on one
+
+//the note data of one sampler module in a single aligned block. the block is sized
+//exactly from the frame counts given to allocate(), every note is a view into it.
+//one allocation per module instead of one per note, released with one free.
+class SpiNoteArena
+{
+public:
+	SpiNoteArena();
+	~SpiNoteArena();
+
+	bool allocate(const unsigned int* frames, int numberofnotes, int channels, bool largepages = false);
+	void release();
+	size_t prefault(); //touches every page, returns the bytes touched
+	bool lock(); //keeps the arena in physical memory until release()
+
+	float* getNoteData(int note) { return notedata[note]; }
+	const float* const* getNoteDataArray() { return &notedata[0]; }
+	const unsigned int* getNoteFramesArray() { return &noteframes[0]; }
+	size_t getSize() { return size; } //bytes
+	bool isLargePages() { return largepages; }
+	bool isLocked() { return locked; }
+
+private:
+	float* arena;
+	size_t size;
+	bool largepages; //allocated with VirtualAlloc(MEM_LARGE_PAGES), already non pageable
+	bool locked;
+	vector<float*> notedata;
+	vector<unsigned int> noteframes;
+};
+
+#endif //_SPINOTEARENA_H
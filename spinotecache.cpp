@@ -0,0 +1,325 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "stdafx.h"
+
+#include <malloc.h> //for _aligned_malloc()
+#include <stdio.h>
+#include <string.h> //for memcpy()
+#include <stdlib.h> //for abs()
+
+#include "spinotecache.h"
+
+SpiNoteCache::SpiNoteCache()
+{
+	for (int m = 0; m < SPINOTECACHE_MAXNUMBEROFMODULES; m++)
+	{
+		for (int n = 0; n < SPINOTECACHE_NUMBEROFNOTES; n++)
+		{
+			Entry& entry = entries[m][n];
+			entry.data = NULL;
+			entry.frames = 0;
+			entry.head = NULL;
+			entry.headframes = 0;
+			entry.spilled = false;
+			entry.pinned = false;
+			entry.loadedat = 0;
+			entry.resident = 0;
+			entry.requested = 0;
+		}
+	}
+	budget = 0;
+	headframes = 0;
+	pclient = NULL;
+	thread = NULL;
+	quit = 0;
+	residentbytes = 0;
+	peakresidentbytes = 0;
+	headbytes = 0;
+	numberofevictions = 0;
+	numberofreloads = 0;
+	numberofmisses = 0;
+}
+
+SpiNoteCache::~SpiNoteCache()
+{
+	stop();
+	clear();
+}
+
+void SpiNoteCache::setup(size_t budget, unsigned int headframes, const string& folder, SpiNoteCacheClient* pclient)
+{
+	this->budget = budget;
+	this->headframes = headframes;
+	this->folder = folder;
+	this->pclient = pclient;
+	if (budget > 0) CreateDirectoryA(folder.c_str(), NULL); //fails harmlessly when it already exists
+}
+
+bool SpiNoteCache::addNote(int module, int note, const float* data, unsigned int frames)
+{
+	Entry& entry = entries[module][note];
+	discard(module, note);
+	if (frames == 0) return false;
+	entry.data = (float*)_aligned_malloc(frames * 2 * sizeof(float), SPINOTECACHE_ALIGNMENT);
+	if (entry.data == NULL) return false;
+	memcpy(entry.data, data, frames * 2 * sizeof(float));
+	entry.frames = frames;
+	entry.spilled = false;
+	entry.pinned = true; //until it has a head
+	if (frames > headframes)
+	{
+		entry.head = (float*)_aligned_malloc(headframes * 2 * sizeof(float), SPINOTECACHE_ALIGNMENT);
+		if (entry.head)
+		{
+			memcpy(entry.head, data, headframes * 2 * sizeof(float));
+			entry.headframes = headframes;
+			entry.pinned = false;
+			headbytes += headframes * 2 * sizeof(float);
+		}
+	}
+	entry.loadedat = 0;
+	entry.resident = 1;
+	residentbytes += frames * 2 * sizeof(float);
+	if (residentbytes > peakresidentbytes) peakresidentbytes = residentbytes;
+	return true;
+}
+
+void SpiNoteCache::request(int module, int note)
+{
+	Entry& entry = entries[module][note];
+	if (entry.frames == 0 || entry.resident) return;
+	InterlockedIncrement(&numberofmisses);
+	entry.requested = 1; //picked up by the worker, no kernel call on the audio thread
+}
+
+bool SpiNoteCache::load(int module, int note)
+{
+	Entry& entry = entries[module][note];
+	if (entry.frames == 0 || entry.data != NULL) return true;
+	return reload(module, note);
+}
+
+string SpiNoteCache::getFileName(int module, int note)
+{
+	char filename[64];
+	sprintf(filename, "\\module%02d_note%03d.f32", module, note);
+	return folder + filename;
+}
+
+bool SpiNoteCache::spill(int module, int note)
+{
+	Entry& entry = entries[module][note];
+	FILE* pFILE = fopen(getFileName(module, note).c_str(), "wb");
+	if (pFILE == NULL) return false;
+	bool written = fwrite(entry.data, 2 * sizeof(float), entry.frames, pFILE) == entry.frames;
+	if (fclose(pFILE) != 0) written = false;
+	entry.spilled = written;
+	return written;
+}
+
+bool SpiNoteCache::reload(int module, int note)
+{
+	Entry& entry = entries[module][note];
+	if (!entry.spilled) return false;
+	float* data = (float*)_aligned_malloc(entry.frames * 2 * sizeof(float), SPINOTECACHE_ALIGNMENT);
+	if (data == NULL) return false;
+	FILE* pFILE = fopen(getFileName(module, note).c_str(), "rb");
+	bool read = pFILE && fread(data, 2 * sizeof(float), entry.frames, pFILE) == entry.frames;
+	if (pFILE) fclose(pFILE);
+	if (!read)
+	{
+		_aligned_free(data);
+		return false;
+	}
+	entry.data = data;
+	entry.loadedat = pclient->getBlockCount(module) + 1; //counts as played now
+	residentbytes += entry.frames * 2 * sizeof(float);
+	if (residentbytes > peakresidentbytes) peakresidentbytes = residentbytes;
+	pclient->publishNote(module, note, data);
+	entry.resident = 1;
+	InterlockedIncrement(&numberofreloads);
+	return true;
+}
+
+//withdraws the note from the audio thread and frees its data. returns 1 when evicted, 0
+//when the note is still in use or cannot be spilled, -1 when the audio thread is not rendering
+int SpiNoteCache::evict(int module, int note)
+{
+	Entry& entry = entries[module][note];
+	if (!entry.spilled && !spill(module, note))
+	{
+		entry.pinned = true; //no way to get it back once freed
+		return 0;
+	}
+	pclient->publishNote(module, note, NULL);
+	if (thread != NULL)
+	{
+		//a voice that read the old data before it was withdrawn did so by block blockcount at
+		//the latest, if it is still playing it stamps the note in block blockcount + 1
+		long blockcount = pclient->getBlockCount(module);
+		DWORD starttime = GetTickCount();
+		while (pclient->getBlockCount(module) < blockcount + 2)
+		{
+			if (quit || GetTickCount() - starttime > SPINOTECACHE_HANDSHAKE_MS)
+			{
+				pclient->publishNote(module, note, entry.data); //audio stopped, keep it
+				return -1;
+			}
+			serviceRequests(); //notes asked for meanwhile are not held up by the eviction
+			Sleep(SPINOTECACHE_HANDSHAKE_POLL_MS);
+		}
+		long lastused = pclient->getNoteLastUsed(module, note);
+		if (lastused >= blockcount + 2)
+		{
+			pclient->publishNote(module, note, entry.data); //played or asked for meanwhile
+			entry.loadedat = lastused;
+			return 0;
+		}
+	}
+	entry.resident = 0;
+	_aligned_free(entry.data);
+	entry.data = NULL;
+	residentbytes -= entry.frames * 2 * sizeof(float);
+	InterlockedIncrement(&numberofevictions);
+	return 1;
+}
+
+void SpiNoteCache::trim()
+{
+	if (budget == 0 || pclient == NULL) return;
+	int attempts = SPINOTECACHE_MAXNUMBEROFMODULES * SPINOTECACHE_NUMBEROFNOTES; //every note in use, give up for now
+	while (residentbytes > budget && attempts-- > 0)
+	{
+		if (thread != NULL) serviceRequests(); //a missed note comes before the budget
+
+		//least recently played resident note, the farthest from the middle of the keyboard first on ties
+		int victimmodule = -1;
+		int victimnote = -1;
+		long victimused = 0;
+		for (int m = 0; m < SPINOTECACHE_MAXNUMBEROFMODULES; m++)
+		{
+			for (int n = 0; n < SPINOTECACHE_NUMBEROFNOTES; n++)
+			{
+				Entry& entry = entries[m][n];
+				if (entry.data == NULL || entry.pinned) continue;
+				long lastused = pclient->getNoteLastUsed(m, n);
+				//without the handshake, a note played in the last block may still be sounding
+				if (thread == NULL && lastused != 0 && lastused >= pclient->getBlockCount(m)) continue;
+				if (thread == NULL && entry.loadedat > pclient->getBlockCount(m)) continue; //loaded for the coming block
+				long used = (lastused > entry.loadedat) ? lastused : entry.loadedat;
+				if (victimmodule < 0 || used < victimused || (used == victimused && abs(n - 60) > abs(victimnote - 60)))
+				{
+					victimmodule = m;
+					victimnote = n;
+					victimused = used;
+				}
+			}
+		}
+		if (victimmodule < 0) break;
+		if (evict(victimmodule, victimnote) < 0) break; //tried again on the next pass
+	}
+}
+
+void SpiNoteCache::serviceRequests()
+{
+	for (int m = 0; m < SPINOTECACHE_MAXNUMBEROFMODULES; m++)
+	{
+		for (int n = 0; n < SPINOTECACHE_NUMBEROFNOTES; n++)
+		{
+			if (!entries[m][n].requested) continue;
+			load(m, n);
+			entries[m][n].requested = 0; //a failed reload is tried again on the next note on
+		}
+	}
+}
+
+bool SpiNoteCache::start()
+{
+	if (budget == 0 || thread != NULL) return false;
+	quit = 0;
+	thread = CreateThread(NULL, 0, WorkerThreadProc, this, 0, NULL);
+	return thread != NULL;
+}
+
+void SpiNoteCache::stop()
+{
+	if (thread == NULL) return;
+	InterlockedExchange(&quit, 1);
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+	thread = NULL;
+}
+
+DWORD WINAPI SpiNoteCache::WorkerThreadProc(LPVOID lpParam)
+{
+	((SpiNoteCache*)lpParam)->work();
+	return 0;
+}
+
+void SpiNoteCache::work()
+{
+	while (!quit)
+	{
+		serviceRequests();
+		trim();
+		Sleep(SPINOTECACHE_POLL_MS);
+	}
+}
+
+void SpiNoteCache::discard(int module, int note)
+{
+	Entry& entry = entries[module][note];
+	if (entry.data)
+	{
+		_aligned_free(entry.data);
+		residentbytes -= entry.frames * 2 * sizeof(float);
+	}
+	if (entry.head)
+	{
+		_aligned_free(entry.head);
+		headbytes -= entry.headframes * 2 * sizeof(float);
+	}
+	if (entry.spilled) remove(getFileName(module, note).c_str());
+	entry.data = NULL;
+	entry.frames = 0;
+	entry.head = NULL;
+	entry.headframes = 0;
+	entry.spilled = false;
+	entry.pinned = false;
+	entry.resident = 0;
+	entry.requested = 0;
+}
+
+void SpiNoteCache::clear()
+{
+	for (int m = 0; m < SPINOTECACHE_MAXNUMBEROFMODULES; m++)
+	{
+		for (int n = 0; n < SPINOTECACHE_NUMBEROFNOTES; n++)
+		{
+			discard(m, n);
+		}
+	}
+	if (budget > 0) RemoveDirectoryA(folder.c_str()); //only once empty
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _SPINOTECACHE_H
+#define _SPINOTECACHE_H
+
+#include <windows.h>
+#include <string>
+
+using namespace std;
+
+#define SPINOTECACHE_MAXNUMBEROFMODULES	16
+#define SPINOTECACHE_NUMBEROFNOTES		128
+#define SPINOTECACHE_POLL_MS			5 //worker period, a missed note is back within about that plus its reload time
+#define SPINOTECACHE_HANDSHAKE_POLL_MS	1 //requests are serviced at this period while an eviction waits on the audio thread
+#define SPINOTECACHE_HANDSHAKE_MS		500 //longest wait for the audio thread to let go of an evicted note
+#define SPINOTECACHE_ALIGNMENT			64 //cache line, same as the note arena
+
+//where the cached notes are played from, implemented by the application. the cache
+//calls it from its worker thread, or from the thread that called trim() or load().
+class SpiNoteCacheClient
+{
+public:
+	virtual ~SpiNoteCacheClient() {}
+	//makes data the note's data for the audio thread, NULL withdraws the note
+	virtual void publishNote(int module, int note, const float* data) = 0;
+	//synthesis blocks rendered so far by the module's sampler
+	virtual long getBlockCount(int module) = 0;
+	//block count plus one of the last block the note was played in, 0 for never
+	virtual long getNoteLastUsed(int module, int note) = 0;
+};
+
+//memory budgeted cache of the gap filled note tables (the pitch shifted ones), the
+//supplied samples stay resident elsewhere. when the resident notes go over the budget
+//the least recently played ones are spilled to a disk cache file, once, and freed.
+//the first headframes of every note stay resident (outside the budget), a note on for
+//an evicted note starts on that head right away while the worker thread reloads the
+//rest. notes no longer than their head are never evicted.
+//
+//eviction handshake: the note is withdrawn from the audio thread, then freed only once
+//the sampler rendered a full block after that without having played it (or been asked
+//for it). otherwise it is published again and stays resident.
+class SpiNoteCache
+{
+public:
+	SpiNoteCache();
+	~SpiNoteCache();
+
+	//budget in bytes, 0 disables the cache. headframes of each note stay resident. folder is
+	//created and holds one file per evicted note
+	void setup(size_t budget, unsigned int headframes, const string& folder, SpiNoteCacheClient* pclient);
+	bool isEnabled() { return budget > 0; }
+
+	//copies the note data (stereo interleaved) into the cache, the note is resident until trim() evicts it
+	bool addNote(int module, int note, const float* data, unsigned int frames);
+	bool isCached(int module, int note) { return entries[module][note].frames > 0; }
+	const float* getNoteData(int module, int note) { return entries[module][note].data; } //NULL when evicted
+	unsigned int getNoteFrames(int module, int note) { return entries[module][note].frames; }
+	const float* getNoteHead(int module, int note) { return entries[module][note].head; } //NULL for a note that is never evicted
+	unsigned int getNoteHeadFrames(int module, int note) { return entries[module][note].headframes; }
+
+	//audio thread, asks the worker to reload the note if it is evicted. the note is played
+	//anyway, from its head until the data is back
+	void request(int module, int note);
+	//reloads the note now if evicted, for the offline render
+	bool load(int module, int note);
+	//evicts the least recently used notes until the resident notes fit in the budget.
+	//without the worker running, only notes not played in the last block are evicted
+	void trim();
+
+	bool start();
+	void stop();
+	void clear(); //frees every note and deletes the disk cache files
+
+	size_t getResidentBytes() { return residentbytes; }
+	size_t getPeakResidentBytes() { return peakresidentbytes; }
+	size_t getHeadBytes() { return headbytes; }
+	long getNumberOfEvictions() { return numberofevictions; }
+	long getNumberOfReloads() { return numberofreloads; }
+	long getNumberOfMisses() { return numberofmisses; } //note ons for an evicted note
+
+private:
+	struct Entry
+	{
+		float* data; //NULL when evicted
+		unsigned int frames; //0 when the note is not cached
+		float* head; //copy of the first headframes, NULL when the note is pinned
+		unsigned int headframes;
+		bool spilled; //the disk cache file holds the note
+		bool pinned; //could not be spilled, stays resident
+		long loadedat; //block count when last made resident, so that a reloaded note is not evicted before it is played
+		volatile long resident;
+		volatile long requested;
+	};
+
+	static DWORD WINAPI WorkerThreadProc(LPVOID lpParam);
+	void work();
+	string getFileName(int module, int note);
+	bool spill(int module, int note);
+	bool reload(int module, int note);
+	int evict(int module, int note);
+	void discard(int module, int note);
+	void serviceRequests();
+
+	Entry entries[SPINOTECACHE_MAXNUMBEROFMODULES][SPINOTECACHE_NUMBEROFNOTES];
+	size_t budget;
+	unsigned int headframes;
+	string folder;
+	SpiNoteCacheClient* pclient;
+	HANDLE thread;
+	volatile LONG quit;
+	size_t residentbytes;
+	size_t peakresidentbytes;
+	size_t headbytes;
+	volatile LONG numberofevictions;
+	volatile LONG numberofreloads;
+	volatile LONG numberofmisses;
+};
+
+#endif //_SPINOTECACHE_H
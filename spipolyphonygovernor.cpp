@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "stdafx.h"
+
+#include "spipolyphonygovernor.h"
+
+SpiPolyphonyGovernor::SpiPolyphonyGovernor()
+{
+	setup(0.0, 0.0, 1, 1);
+}
+
+void SpiPolyphonyGovernor::setup(double highload_percent, double hysteresis_percent, int minvoices, int maxvoices)
+{
+	highload = highload_percent / 100.0;
+	lowload = (highload_percent - hysteresis_percent) / 100.0;
+	maxvoicelimit = (maxvoices > 1) ? maxvoices : 1;
+	minvoicelimit = (minvoices < 1) ? 1 : ((minvoices > maxvoicelimit) ? maxvoicelimit : minvoices);
+	voicelimit = maxvoicelimit;
+	lowestvoicelimit = maxvoicelimit;
+	sincechange_s = 0.0;
+	underlow_s = 0.0;
+	numberofreductions = 0;
+}
+
+bool SpiPolyphonyGovernor::update(double blockload_percent, double smoothedload_percent, unsigned long numberofframes, double samplerate)
+{
+	if (!isEnabled()) return false;
+	double block_s = numberofframes / samplerate;
+	sincechange_s += block_s;
+	underlow_s = (smoothedload_percent / 100.0 < lowload) ? underlow_s + block_s : 0.0;
+
+	//over the deadline budget, shed voices right away
+	if (blockload_percent / 100.0 > highload && voicelimit > minvoicelimit && sincechange_s >= SPIPOLYPHONYGOVERNOR_DECREASEHOLD_S)
+	{
+		int reduction = voicelimit / 4;
+		if (reduction < 1) reduction = 1;
+		voicelimit = (voicelimit - reduction > minvoicelimit) ? voicelimit - reduction : minvoicelimit;
+		if (voicelimit < lowestvoicelimit) lowestvoicelimit = voicelimit;
+		numberofreductions++;
+		sincechange_s = 0.0;
+		underlow_s = 0.0;
+		return true;
+	}
+	//comfortably under it, give voices back one at a time
+	if (underlow_s >= SPIPOLYPHONYGOVERNOR_INCREASEHOLD_S && voicelimit < maxvoicelimit)
+	{
+		voicelimit++;
+		sincechange_s = 0.0;
+		underlow_s = 0.0;
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _SPIPOLYPHONYGOVERNOR_H
+#define _SPIPOLYPHONYGOVERNOR_H
+
+#define SPIPOLYPHONYGOVERNOR_DECREASEHOLD_S	0.1 //shortest time between two polyphony reductions
+#define SPIPOLYPHONYGOVERNOR_INCREASEHOLD_S	1.0 //time under the low threshold before a voice is given back
+
+//adaptive polyphony limit driven by the render callback load. update() is called once
+//per callback with the load of that block (see SpiLoadMeter::getBlockLoad()): a block
+//over the high threshold cuts the per module voice limit by a quarter, the limit then
+//grows back by one voice each time the smoothed load has stayed under the low threshold
+//(high threshold minus the hysteresis) for a while. audio thread only, no locks.
+class SpiPolyphonyGovernor
+{
+public:
+	SpiPolyphonyGovernor();
+
+	//highload_percent 0 disables the governor, the limit then stays at maxvoices
+	void setup(double highload_percent, double hysteresis_percent, int minvoices, int maxvoices);
+	bool isEnabled() { return highload > 0.0; }
+
+	//returns true when the voice limit changed
+	bool update(double blockload_percent, double smoothedload_percent, unsigned long numberofframes, double samplerate);
+
+	int getVoiceLimit() { return voicelimit; }
+	long getNumberOfReductions() { return numberofreductions; }
+	int getLowestVoiceLimit() { return lowestvoicelimit; }
+
+private:
+	double highload; //fraction of the deadline
+	double lowload;
+	int minvoicelimit;
+	int maxvoicelimit;
+	volatile int voicelimit;
+	double sincechange_s; //time since the last change of the limit
+	double underlow_s; //time the smoothed load has been under the low threshold
+	volatile long numberofreductions;
+	volatile int lowestvoicelimit;
+};
+
+#endif //_SPIPOLYPHONYGOVERNOR_H
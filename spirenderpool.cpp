@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "stdafx.h"
+#include <intrin.h> //for _mm_pause()
+#include <avrt.h> //for AvSetMmThreadCharacteristics()
+
+#include "spirenderpool.h"
+#include "spirtcheck.h"
+#include "spidenormal.h"
+
+#define SPIRENDERPOOL_SPINMICROSECONDS	200 //spin after a fork before sleeping, covers the next block of a callback
+#define SPIRENDERPOOL_SPINSPERCLOCKREAD	64
+
+
+SpiRenderPool::SpiRenderPool()
+{
+	hwakeup = NULL;
+	quit = 0;
+	sleepers = 0;
+	generation = 0;
+	jobsremaining = 0;
+	jobsdone = 0;
+	jobfn = NULL;
+	jobuserdata = NULL;
+}
+
+SpiRenderPool::~SpiRenderPool()
+{
+	stop();
+}
+
+bool SpiRenderPool::start(int numberofthreads)
+{
+	if (!threads.empty()) return false;
+	if (numberofthreads < 0)
+	{
+		SYSTEM_INFO mySYSTEM_INFO;
+		GetSystemInfo(&mySYSTEM_INFO);
+		numberofthreads = (int)mySYSTEM_INFO.dwNumberOfProcessors - 1; //the audio thread renders too
+	}
+	hwakeup = CreateSemaphore(NULL, 0, 0x7fffffff, NULL);
+	if (hwakeup == NULL) return false;
+	quit = 0;
+	sleepers = 0;
+	for (int i = 0; i < numberofthreads; i++)
+	{
+		HANDLE hThread = CreateThread(NULL, 0, WorkerThreadProc, this, 0, NULL);
+		if (hThread == NULL) break;
+		threads.push_back(hThread);
+	}
+	if (threads.empty())
+	{
+		CloseHandle(hwakeup);
+		hwakeup = NULL;
+		return false;
+	}
+	return true;
+}
+
+void SpiRenderPool::stop()
+{
+	if (threads.empty()) return;
+	InterlockedExchange(&quit, 1);
+	ReleaseSemaphore(hwakeup, (LONG)threads.size(), NULL);
+	WaitForMultipleObjects((DWORD)threads.size(), &threads[0], TRUE, INFINITE);
+	for (unsigned int i = 0; i < threads.size(); i++)
+	{
+		CloseHandle(threads[i]);
+	}
+	threads.clear();
+	CloseHandle(hwakeup);
+	hwakeup = NULL;
+}
+
+DWORD WINAPI SpiRenderPool::WorkerThreadProc(LPVOID lpParam)
+{
+	((SpiRenderPool*)lpParam)->work();
+	return 0;
+}
+
+void SpiRenderPool::runjobs()
+{
+	//grab jobs with a compare-exchange so that a late worker never consumes a job it does not run
+	for (;;)
+	{
+		LONG remaining = jobsremaining;
+		if (remaining <= 0) break;
+		if (InterlockedCompareExchange(&jobsremaining, remaining - 1, remaining) != remaining) continue;
+		jobfn(jobuserdata, remaining - 1);
+		InterlockedIncrement(&jobsdone);
+	}
+}
+
+void SpiRenderPool::work()
+{
+	SpiDenormal_DisableOnThisThread(); //renders modules like the audio thread
+
+	//same scheduling class as the audio thread, not time-critical on every core
+	DWORD taskindex = 0;
+	HANDLE hmmcss = AvSetMmThreadCharacteristics(TEXT("Pro Audio"), &taskindex);
+	if (hmmcss == NULL) SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST); //mmcss service not available
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	LONGLONG spinticks = frequency.QuadPart * SPIRENDERPOOL_SPINMICROSECONDS / 1000000;
+	LARGE_INTEGER spinstart;
+	QueryPerformanceCounter(&spinstart);
+	LONG lastgeneration = generation;
+	int spins = 0;
+	while (quit == 0)
+	{
+		if (generation == lastgeneration)
+		{
+			_mm_pause();
+			if ((++spins % SPIRENDERPOOL_SPINSPERCLOCKREAD) != 0) continue;
+			LARGE_INTEGER now;
+			QueryPerformanceCounter(&now);
+			if (now.QuadPart - spinstart.QuadPart < spinticks) continue;
+
+			//nothing posted for a while, sleep until the next fork. the generation is
+			//read again after registering as a sleeper, so that either run() sees this
+			//worker and releases the semaphore or this worker sees the new generation.
+			//a release for a worker that did not wait only causes one spurious wakeup.
+			InterlockedIncrement(&sleepers);
+			if (generation == lastgeneration && quit == 0)
+			{
+				WaitForSingleObject(hwakeup, INFINITE);
+			}
+			QueryPerformanceCounter(&spinstart);
+			spins = 0;
+			continue;
+		}
+		lastgeneration = generation;
+		SpiRtCheck_Enter(); //the jobs are part of the audio callback
+		runjobs();
+		SpiRtCheck_Leave();
+		QueryPerformanceCounter(&spinstart);
+		spins = 0;
+	}
+
+	if (hmmcss) AvRevertMmThreadCharacteristics(hmmcss);
+}
+
+void SpiRenderPool::run(SpiRenderJobFn fn, void* userdata, int numberofjobs)
+{
+	if (threads.empty())
+	{
+		//no pool, render serially on the calling thread
+		for (int i = 0; i < numberofjobs; i++) fn(userdata, i);
+		return;
+	}
+
+	//fork, jobsremaining is zero here so no worker can pick up a half published job
+	jobfn = fn;
+	jobuserdata = userdata;
+	jobsdone = 0;
+	InterlockedExchange(&jobsremaining, numberofjobs);
+	InterlockedIncrement(&generation);
+
+	//wake the workers that went to sleep since the last fork, none when they are still spinning
+	LONG numberofsleepers = InterlockedExchange(&sleepers, 0);
+	if (numberofsleepers > 0) ReleaseSemaphore(hwakeup, numberofsleepers, NULL);
+
+	//the caller works too
+	runjobs();
+
+	//join
+	while (jobsdone < numberofjobs)
+	{
+		_mm_pause();
+	}
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _SPIRENDERPOOL_H
+#define _SPIRENDERPOOL_H
+
+#include <windows.h>
+#include <vector>
+
+using namespace std;
+
+//job callback, called once per job index on any thread of the pool (including the caller)
+typedef void (*SpiRenderJobFn)(void* userdata, int jobindex);
+
+//pool of real-time worker threads used to render independent parts of the audio
+//graph in parallel. run() is a lock-free fork-join: the caller publishes the jobs,
+//takes part in the work and spins until every job is done. workers run in the
+//"Pro Audio" mmcss class like the audio thread, they spin for a short while after
+//each fork to catch the next block of the same callback and then sleep on a
+//semaphore that run() releases only when a worker is asleep.
+class SpiRenderPool
+{
+public:
+	SpiRenderPool();
+	~SpiRenderPool();
+
+	bool start(int numberofthreads); //-1 for one thread per core minus the audio thread
+	void stop();
+	int getNumberOfThreads() { return (int)threads.size(); }
+
+	void run(SpiRenderJobFn fn, void* userdata, int numberofjobs);
+
+private:
+	static DWORD WINAPI WorkerThreadProc(LPVOID lpParam);
+	void work();
+	void runjobs();
+
+	vector<HANDLE> threads;
+	HANDLE hwakeup;              //released by run() once per sleeping worker
+	volatile LONG quit;
+	volatile LONG sleepers;      //workers about to wait or waiting on hwakeup
+	volatile LONG generation;    //bumped once per fork
+	volatile LONG jobsremaining; //jobs not yet grabbed, only set above zero once a fork is published
+	volatile LONG jobsdone;      //jobs completed for the current fork
+	SpiRenderJobFn volatile jobfn;
+	void* volatile jobuserdata;
+};
+
+#endif //_SPIRENDERPOOL_H
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "stdafx.h"
+#include <math.h>
+#include <vector>
+
+#include "spiresample.h"
+
+using namespace std;
+
+static vector<float> global_resamplekernel;
+
+//windowed sinc from 0 to SPIRESAMPLE_HALFWIDTH zero crossings, one extra entry for the interpolation
+static void SpiResample_BuildKernel()
+{
+	const double pi = 3.14159265358979;
+	int size = SPIRESAMPLE_HALFWIDTH * SPIRESAMPLE_OVERSAMPLING + 2;
+	global_resamplekernel.resize(size);
+	for (int i = 0; i < size; i++)
+	{
+		double x = (double)i / SPIRESAMPLE_OVERSAMPLING;
+		if (x >= SPIRESAMPLE_HALFWIDTH)
+		{
+			global_resamplekernel[i] = 0.0f;
+			continue;
+		}
+		double sinc = (i == 0) ? 1.0 : sin(pi * x) / (pi * x);
+		double phase = pi * (x / SPIRESAMPLE_HALFWIDTH + 1.0); //blackman window centered on x = 0
+		double window = 0.42 - 0.5 * cos(phase) + 0.08 * cos(2.0 * phase);
+		global_resamplekernel[i] = (float)(sinc * window);
+	}
+}
+
+long SpiResample_GetNumberOfFrames(long inputframes, double inputrate, double outputrate)
+{
+	return (long)((double)inputframes * outputrate / inputrate + 0.5);
+}
+
+void SpiResample(const float* input, long inputframes, int numberofchannels, double inputrate,
+	float* output, long outputframes, double outputrate)
+{
+	if (global_resamplekernel.empty()) SpiResample_BuildKernel();
+
+	double step = inputrate / outputrate; //input frames per output frame
+	double cutoff = ((step > 1.0) ? 1.0 / step : 1.0) * SPIRESAMPLE_ROLLOFF; //fraction of the input nyquist kept
+	double halfwidth = SPIRESAMPLE_HALFWIDTH / cutoff; //kernel half width in input frames
+	for (long o = 0; o < outputframes; o++)
+	{
+		double center = o * step;
+		long first = (long)floor(center - halfwidth) + 1;
+		long last = (long)floor(center + halfwidth);
+		if (first < 0) first = 0;
+		if (last > inputframes - 1) last = inputframes - 1;
+
+		for (int c = 0; c < numberofchannels; c++) output[o * numberofchannels + c] = 0.0f;
+		for (long i = first; i <= last; i++)
+		{
+			double position = fabs(center - i) * cutoff * SPIRESAMPLE_OVERSAMPLING;
+			int index = (int)position;
+			if (index >= SPIRESAMPLE_HALFWIDTH * SPIRESAMPLE_OVERSAMPLING) continue;
+			float fraction = (float)(position - index);
+			float weight = (float)cutoff * (global_resamplekernel[index] + fraction * (global_resamplekernel[index + 1] - global_resamplekernel[index]));
+			const float* frame = input + i * numberofchannels;
+			for (int c = 0; c < numberofchannels; c++) output[o * numberofchannels + c] += weight * frame[c];
+		}
+	}
+}
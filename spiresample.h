@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef _SPIRESAMPLE_H
+#define _SPIRESAMPLE_H
+
+#define SPIRESAMPLE_HALFWIDTH		16 //zero crossings of the sinc kernel on each side of the output frame
+#define SPIRESAMPLE_OVERSAMPLING	256 //kernel table entries per zero crossing, linearly interpolated
+#define SPIRESAMPLE_ROLLOFF			0.92 //cutoff relative to the lower nyquist, leaves room for the transition band
+
+//number of frames a sample of inputframes frames has once converted to outputrate
+long SpiResample_GetNumberOfFrames(long inputframes, double inputrate, double outputrate);
+
+//load time sample rate conversion of interleaved float frames with a blackman windowed
+//sinc. the cutoff sits just below the lower of the two nyquist frequencies so
+//nothing folds back when downsampling and no images are left when upsampling.
+//not meant for the audio thread, the kernel table is built on first use.
+void SpiResample(const float* input, long inputframes, int numberofchannels, double inputrate,
+	float* output, long outputframes, double outputrate);
+
+#endif //_SPIRESAMPLE_H
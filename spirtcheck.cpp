@@ -0,0 +1,338 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "stdafx.h"
+#include <string.h>
+#ifdef _DEBUG
+#include <crtdbg.h> //for _CrtSetAllocHook()
+#endif
+
+#include "spirtcheck.h"
+
+struct SpiRtCheckRecord
+{
+	int kind;
+	DWORD threadid;
+	WORD numberofframes;
+	PVOID frames[SPIRTCHECK_MAXFRAMES];
+};
+
+static __declspec(thread) int tls_realtimedepth = 0;
+static volatile LONG global_rtcheckviolations[SPIRTCHECK_NUMBEROFKINDS] = { 0 };
+static volatile LONG global_rtchecknumberofrecords = 0;
+static SpiRtCheckRecord global_rtcheckrecords[SPIRTCHECK_MAXRECORDS];
+static const char* global_rtcheckkindnames[SPIRTCHECK_NUMBEROFKINDS] = { "alloc", "lock", "io" };
+static bool global_rtcheckallochook = false;
+static const char* global_rtcheckpatched[SPIRTCHECK_MAXPATCHES]; //imports found and interposed
+static int global_rtchecknumberofpatched = 0;
+static const char* global_rtcheckmissing[SPIRTCHECK_MAXPATCHES]; //imports the executable does not use
+static int global_rtchecknumberofmissing = 0;
+
+void SpiRtCheck_Enter()
+{
+	tls_realtimedepth++;
+}
+
+void SpiRtCheck_Leave()
+{
+	tls_realtimedepth--;
+}
+
+void SpiRtCheck_Check(int kind)
+{
+	if (tls_realtimedepth <= 0) return;
+	InterlockedIncrement(&global_rtcheckviolations[kind]);
+	LONG index = InterlockedIncrement(&global_rtchecknumberofrecords) - 1;
+	if (index >= SPIRTCHECK_MAXRECORDS) return;
+	SpiRtCheckRecord& record = global_rtcheckrecords[index];
+	record.kind = kind;
+	record.threadid = GetCurrentThreadId();
+	record.numberofframes = CaptureStackBackTrace(1, SPIRTCHECK_MAXFRAMES, record.frames, NULL);
+}
+
+long SpiRtCheck_GetNumberOfViolations(int kind)
+{
+	return global_rtcheckviolations[kind];
+}
+
+long SpiRtCheck_GetTotalNumberOfViolations()
+{
+	long total = 0;
+	for (int kind = 0; kind < SPIRTCHECK_NUMBEROFKINDS; kind++) total += global_rtcheckviolations[kind];
+	return total;
+}
+
+void SpiRtCheck_Report(FILE* pFILE)
+{
+	if (pFILE == NULL) return;
+	//what was actually checked, a clean report only covers these
+	fprintf(pFILE, "real-time check limits: only the imports of the executable are patched, locks, waits, i/o and\n");
+	fprintf(pFILE, "allocations made inside other modules (crt and msvcp dlls, std::mutex, portaudio, portmidi) are not seen\n");
+	fprintf(pFILE, "alloc check: %s\n", global_rtcheckallochook ? "active, debug crt heap hook" : "NOT active, needs the debug crt heap hook");
+	fprintf(pFILE, "lock and io checks active on:");
+	for (int i = 0; i < global_rtchecknumberofpatched; i++) fprintf(pFILE, " %s", global_rtcheckpatched[i]);
+	fprintf(pFILE, "%s\n", (global_rtchecknumberofpatched == 0) ? " none" : "");
+	if (global_rtchecknumberofmissing > 0)
+	{
+		fprintf(pFILE, "not imported by the executable, not checked:");
+		for (int i = 0; i < global_rtchecknumberofmissing; i++) fprintf(pFILE, " %s", global_rtcheckmissing[i]);
+		fprintf(pFILE, "\n");
+	}
+	fprintf(pFILE, "real-time check: %d alloc, %d lock, %d io violations\n",
+		(int)global_rtcheckviolations[SPIRTCHECK_ALLOC], (int)global_rtcheckviolations[SPIRTCHECK_LOCK], (int)global_rtcheckviolations[SPIRTCHECK_IO]);
+	LONG numberofrecords = global_rtchecknumberofrecords;
+	if (numberofrecords > SPIRTCHECK_MAXRECORDS) numberofrecords = SPIRTCHECK_MAXRECORDS;
+	for (LONG i = 0; i < numberofrecords; i++)
+	{
+		SpiRtCheckRecord& record = global_rtcheckrecords[i];
+		fprintf(pFILE, "violation %d, %s on thread %u\n", (int)i, global_rtcheckkindnames[record.kind], (unsigned int)record.threadid);
+		for (WORD f = 0; f < record.numberofframes; f++)
+		{
+			HMODULE hModule = NULL;
+			char modulename[MAX_PATH] = "?";
+			if (GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT, (LPCSTR)record.frames[f], &hModule))
+			{
+				GetModuleFileNameA(hModule, modulename, MAX_PATH);
+			}
+			const char* shortname = strrchr(modulename, '\\');
+			shortname = shortname ? shortname + 1 : modulename;
+			fprintf(pFILE, "    %s+0x%x\n", shortname, (unsigned int)((BYTE*)record.frames[f] - (BYTE*)hModule));
+		}
+	}
+	fflush(pFILE);
+}
+
+#ifdef _DEBUG
+static int __cdecl SpiRtCheckAllocHook(int allocType, void* userData, size_t size, int blockType, long requestNumber, const unsigned char* filename, int lineNumber)
+{
+	SpiRtCheck_Check(SPIRTCHECK_ALLOC);
+	return TRUE;
+}
+#endif
+
+////////////////////////////////////////////////////////////
+//interposed imports, checked then forwarded to the original
+////////////////////////////////////////////////////////////
+
+typedef void (WINAPI *EnterCriticalSectionFn)(LPCRITICAL_SECTION);
+typedef void (WINAPI *AcquireSRWLockFn)(PSRWLOCK);
+typedef BOOL (WINAPI *SleepConditionVariableCSFn)(PCONDITION_VARIABLE, PCRITICAL_SECTION, DWORD);
+typedef BOOL (WINAPI *SleepConditionVariableSRWFn)(PCONDITION_VARIABLE, PSRWLOCK, DWORD, ULONG);
+typedef DWORD (WINAPI *WaitForSingleObjectFn)(HANDLE, DWORD);
+typedef DWORD (WINAPI *WaitForMultipleObjectsFn)(DWORD, const HANDLE*, BOOL, DWORD);
+typedef HANDLE (WINAPI *CreateFileAFn)(LPCSTR, DWORD, DWORD, LPSECURITY_ATTRIBUTES, DWORD, DWORD, HANDLE);
+typedef HANDLE (WINAPI *CreateFileWFn)(LPCWSTR, DWORD, DWORD, LPSECURITY_ATTRIBUTES, DWORD, DWORD, HANDLE);
+typedef BOOL (WINAPI *ReadFileFn)(HANDLE, LPVOID, DWORD, LPDWORD, LPOVERLAPPED);
+typedef BOOL (WINAPI *WriteFileFn)(HANDLE, LPCVOID, DWORD, LPDWORD, LPOVERLAPPED);
+typedef FILE* (__cdecl *fopenFn)(const char*, const char*);
+typedef size_t (__cdecl *freadFn)(void*, size_t, size_t, FILE*);
+typedef size_t (__cdecl *fwriteFn)(const void*, size_t, size_t, FILE*);
+typedef int (__cdecl *fflushFn)(FILE*);
+
+static EnterCriticalSectionFn original_EnterCriticalSection = NULL;
+static AcquireSRWLockFn original_AcquireSRWLockExclusive = NULL;
+static AcquireSRWLockFn original_AcquireSRWLockShared = NULL;
+static SleepConditionVariableCSFn original_SleepConditionVariableCS = NULL;
+static SleepConditionVariableSRWFn original_SleepConditionVariableSRW = NULL;
+static WaitForSingleObjectFn original_WaitForSingleObject = NULL;
+static WaitForMultipleObjectsFn original_WaitForMultipleObjects = NULL;
+static CreateFileAFn original_CreateFileA = NULL;
+static CreateFileWFn original_CreateFileW = NULL;
+static ReadFileFn original_ReadFile = NULL;
+static WriteFileFn original_WriteFile = NULL;
+static fopenFn original_fopen = NULL;
+static freadFn original_fread = NULL;
+static fwriteFn original_fwrite = NULL;
+static fflushFn original_fflush = NULL;
+
+static void WINAPI Checked_EnterCriticalSection(LPCRITICAL_SECTION lpCriticalSection)
+{
+	SpiRtCheck_Check(SPIRTCHECK_LOCK);
+	original_EnterCriticalSection(lpCriticalSection);
+}
+
+static void WINAPI Checked_AcquireSRWLockExclusive(PSRWLOCK SRWLock)
+{
+	SpiRtCheck_Check(SPIRTCHECK_LOCK);
+	original_AcquireSRWLockExclusive(SRWLock);
+}
+
+static void WINAPI Checked_AcquireSRWLockShared(PSRWLOCK SRWLock)
+{
+	SpiRtCheck_Check(SPIRTCHECK_LOCK);
+	original_AcquireSRWLockShared(SRWLock);
+}
+
+static BOOL WINAPI Checked_SleepConditionVariableCS(PCONDITION_VARIABLE ConditionVariable, PCRITICAL_SECTION CriticalSection, DWORD dwMilliseconds)
+{
+	if (dwMilliseconds != 0) SpiRtCheck_Check(SPIRTCHECK_LOCK);
+	return original_SleepConditionVariableCS(ConditionVariable, CriticalSection, dwMilliseconds);
+}
+
+static BOOL WINAPI Checked_SleepConditionVariableSRW(PCONDITION_VARIABLE ConditionVariable, PSRWLOCK SRWLock, DWORD dwMilliseconds, ULONG Flags)
+{
+	if (dwMilliseconds != 0) SpiRtCheck_Check(SPIRTCHECK_LOCK);
+	return original_SleepConditionVariableSRW(ConditionVariable, SRWLock, dwMilliseconds, Flags);
+}
+
+static DWORD WINAPI Checked_WaitForSingleObject(HANDLE hHandle, DWORD dwMilliseconds)
+{
+	if (dwMilliseconds != 0) SpiRtCheck_Check(SPIRTCHECK_LOCK); //polling with a zero timeout never blocks
+	return original_WaitForSingleObject(hHandle, dwMilliseconds);
+}
+
+static DWORD WINAPI Checked_WaitForMultipleObjects(DWORD nCount, const HANDLE* lpHandles, BOOL bWaitAll, DWORD dwMilliseconds)
+{
+	if (dwMilliseconds != 0) SpiRtCheck_Check(SPIRTCHECK_LOCK);
+	return original_WaitForMultipleObjects(nCount, lpHandles, bWaitAll, dwMilliseconds);
+}
+
+static HANDLE WINAPI Checked_CreateFileA(LPCSTR lpFileName, DWORD dwDesiredAccess, DWORD dwShareMode, LPSECURITY_ATTRIBUTES lpSecurityAttributes, DWORD dwCreationDisposition, DWORD dwFlagsAndAttributes, HANDLE hTemplateFile)
+{
+	SpiRtCheck_Check(SPIRTCHECK_IO);
+	return original_CreateFileA(lpFileName, dwDesiredAccess, dwShareMode, lpSecurityAttributes, dwCreationDisposition, dwFlagsAndAttributes, hTemplateFile);
+}
+
+static HANDLE WINAPI Checked_CreateFileW(LPCWSTR lpFileName, DWORD dwDesiredAccess, DWORD dwShareMode, LPSECURITY_ATTRIBUTES lpSecurityAttributes, DWORD dwCreationDisposition, DWORD dwFlagsAndAttributes, HANDLE hTemplateFile)
+{
+	SpiRtCheck_Check(SPIRTCHECK_IO);
+	return original_CreateFileW(lpFileName, dwDesiredAccess, dwShareMode, lpSecurityAttributes, dwCreationDisposition, dwFlagsAndAttributes, hTemplateFile);
+}
+
+static BOOL WINAPI Checked_ReadFile(HANDLE hFile, LPVOID lpBuffer, DWORD nNumberOfBytesToRead, LPDWORD lpNumberOfBytesRead, LPOVERLAPPED lpOverlapped)
+{
+	SpiRtCheck_Check(SPIRTCHECK_IO);
+	return original_ReadFile(hFile, lpBuffer, nNumberOfBytesToRead, lpNumberOfBytesRead, lpOverlapped);
+}
+
+static BOOL WINAPI Checked_WriteFile(HANDLE hFile, LPCVOID lpBuffer, DWORD nNumberOfBytesToWrite, LPDWORD lpNumberOfBytesWritten, LPOVERLAPPED lpOverlapped)
+{
+	SpiRtCheck_Check(SPIRTCHECK_IO);
+	return original_WriteFile(hFile, lpBuffer, nNumberOfBytesToWrite, lpNumberOfBytesWritten, lpOverlapped);
+}
+
+static FILE* __cdecl Checked_fopen(const char* filename, const char* mode)
+{
+	SpiRtCheck_Check(SPIRTCHECK_IO);
+	return original_fopen(filename, mode);
+}
+
+static size_t __cdecl Checked_fread(void* buffer, size_t size, size_t count, FILE* stream)
+{
+	SpiRtCheck_Check(SPIRTCHECK_IO);
+	return original_fread(buffer, size, count, stream);
+}
+
+static size_t __cdecl Checked_fwrite(const void* buffer, size_t size, size_t count, FILE* stream)
+{
+	SpiRtCheck_Check(SPIRTCHECK_IO);
+	return original_fwrite(buffer, size, count, stream);
+}
+
+static int __cdecl Checked_fflush(FILE* stream)
+{
+	SpiRtCheck_Check(SPIRTCHECK_IO);
+	return original_fflush(stream);
+}
+
+//replaces the import address table entry of functionname in module, keeps the original
+static bool SpiRtCheckPatchImport(HMODULE hModule, const char* functionname, void* replacement, void** original)
+{
+	BYTE* base = (BYTE*)hModule;
+	IMAGE_DOS_HEADER* pDosHeader = (IMAGE_DOS_HEADER*)base;
+	IMAGE_NT_HEADERS* pNtHeaders = (IMAGE_NT_HEADERS*)(base + pDosHeader->e_lfanew);
+	IMAGE_DATA_DIRECTORY& importdirectory = pNtHeaders->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT];
+	if (importdirectory.VirtualAddress == 0) return false;
+
+	bool patched = false;
+	for (IMAGE_IMPORT_DESCRIPTOR* pImport = (IMAGE_IMPORT_DESCRIPTOR*)(base + importdirectory.VirtualAddress); pImport->Name != 0; pImport++)
+	{
+		if (pImport->OriginalFirstThunk == 0) continue; //no name table to match against
+		IMAGE_THUNK_DATA* pNameThunk = (IMAGE_THUNK_DATA*)(base + pImport->OriginalFirstThunk);
+		IMAGE_THUNK_DATA* pAddressThunk = (IMAGE_THUNK_DATA*)(base + pImport->FirstThunk);
+		for (; pNameThunk->u1.AddressOfData != 0; pNameThunk++, pAddressThunk++)
+		{
+			if (IMAGE_SNAP_BY_ORDINAL(pNameThunk->u1.Ordinal)) continue;
+			IMAGE_IMPORT_BY_NAME* pImportByName = (IMAGE_IMPORT_BY_NAME*)(base + pNameThunk->u1.AddressOfData);
+			if (strcmp((const char*)pImportByName->Name, functionname) != 0) continue;
+
+			DWORD oldprotect;
+			VirtualProtect(&pAddressThunk->u1.Function, sizeof(void*), PAGE_READWRITE, &oldprotect);
+			if (*original == NULL) *original = (void*)pAddressThunk->u1.Function;
+			pAddressThunk->u1.Function = (ULONG_PTR)replacement;
+			VirtualProtect(&pAddressThunk->u1.Function, sizeof(void*), oldprotect, &oldprotect);
+			patched = true;
+		}
+	}
+	return patched;
+}
+
+//patches one import and keeps track of it for the report
+static void SpiRtCheckInterpose(HMODULE hModule, const char* functionname, void* replacement, void** original)
+{
+	if (SpiRtCheckPatchImport(hModule, functionname, replacement, original))
+	{
+		if (global_rtchecknumberofpatched < SPIRTCHECK_MAXPATCHES) global_rtcheckpatched[global_rtchecknumberofpatched++] = functionname;
+	}
+	else
+	{
+		if (global_rtchecknumberofmissing < SPIRTCHECK_MAXPATCHES) global_rtcheckmissing[global_rtchecknumberofmissing++] = functionname;
+	}
+}
+
+bool SpiRtCheck_Install()
+{
+#if SPIRTCHECK_ENABLED
+	static bool installed = false;
+	if (installed) return true;
+	installed = true;
+
+#ifdef _DEBUG
+	_CrtSetAllocHook(SpiRtCheckAllocHook);
+	global_rtcheckallochook = true;
+#endif
+
+	//only the executable is patched, the statically linked tonic library included. the
+	//crt and msvcp dlls call the kernel directly, their locks (std::mutex) are not seen
+	HMODULE hModule = GetModuleHandle(NULL);
+	SpiRtCheckInterpose(hModule, "EnterCriticalSection", (void*)Checked_EnterCriticalSection, (void**)&original_EnterCriticalSection);
+	SpiRtCheckInterpose(hModule, "AcquireSRWLockExclusive", (void*)Checked_AcquireSRWLockExclusive, (void**)&original_AcquireSRWLockExclusive);
+	SpiRtCheckInterpose(hModule, "AcquireSRWLockShared", (void*)Checked_AcquireSRWLockShared, (void**)&original_AcquireSRWLockShared);
+	SpiRtCheckInterpose(hModule, "SleepConditionVariableCS", (void*)Checked_SleepConditionVariableCS, (void**)&original_SleepConditionVariableCS);
+	SpiRtCheckInterpose(hModule, "SleepConditionVariableSRW", (void*)Checked_SleepConditionVariableSRW, (void**)&original_SleepConditionVariableSRW);
+	SpiRtCheckInterpose(hModule, "WaitForSingleObject", (void*)Checked_WaitForSingleObject, (void**)&original_WaitForSingleObject);
+	SpiRtCheckInterpose(hModule, "WaitForMultipleObjects", (void*)Checked_WaitForMultipleObjects, (void**)&original_WaitForMultipleObjects);
+	SpiRtCheckInterpose(hModule, "CreateFileA", (void*)Checked_CreateFileA, (void**)&original_CreateFileA);
+	SpiRtCheckInterpose(hModule, "CreateFileW", (void*)Checked_CreateFileW, (void**)&original_CreateFileW);
+	SpiRtCheckInterpose(hModule, "ReadFile", (void*)Checked_ReadFile, (void**)&original_ReadFile);
+	SpiRtCheckInterpose(hModule, "WriteFile", (void*)Checked_WriteFile, (void**)&original_WriteFile);
+	SpiRtCheckInterpose(hModule, "fopen", (void*)Checked_fopen, (void**)&original_fopen);
+	SpiRtCheckInterpose(hModule, "fread", (void*)Checked_fread, (void**)&original_fread);
+	SpiRtCheckInterpose(hModule, "fwrite", (void*)Checked_fwrite, (void**)&original_fwrite);
+	SpiRtCheckInterpose(hModule, "fflush", (void*)Checked_fflush, (void**)&original_fflush);
+	return true;
+#else
+	return false;
+#endif
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _SPIRTCHECK_H
+#define _SPIRTCHECK_H
+
+#include <windows.h>
+#include <stdio.h>
+
+//real-time safety checker, on by default in debug builds. define SPIRTCHECK_ENABLED
+//to 1 to get it in a release test build (lock and i/o checks only, the heap hook
+//needs the debug crt) or to 0 to compile it out of a debug build.
+#ifndef SPIRTCHECK_ENABLED
+#ifdef _DEBUG
+#define SPIRTCHECK_ENABLED	1
+#else
+#define SPIRTCHECK_ENABLED	0
+#endif
+#endif
+
+#define SPIRTCHECK_ALLOC		0 //malloc, free, realloc, new and delete
+#define SPIRTCHECK_LOCK			1 //critical sections, srw locks, condition variables and waits on kernel objects
+#define SPIRTCHECK_IO			2 //file i/o
+#define SPIRTCHECK_NUMBEROFKINDS	3
+
+#define SPIRTCHECK_MAXRECORDS	64 //violations kept with their stack, the counters go on
+#define SPIRTCHECK_MAXFRAMES	16
+#define SPIRTCHECK_MAXPATCHES	32 //imports interposed by SpiRtCheck_Install()
+
+//install the heap hook and patch the lock and i/o imports of the executable,
+//call once at startup before any real-time thread runs. calls made from other
+//modules (crt and msvcp dlls, std::mutex) are not seen, see the report header
+bool SpiRtCheck_Install();
+//mark the calling thread as real-time until the matching leave, may be nested
+void SpiRtCheck_Enter();
+void SpiRtCheck_Leave();
+//counts a violation if the calling thread is inside a real-time section
+void SpiRtCheck_Check(int kind);
+long SpiRtCheck_GetNumberOfViolations(int kind);
+long SpiRtCheck_GetTotalNumberOfViolations();
+//writes which checks are active, the counters and the recorded stacks (module+offset per frame)
+void SpiRtCheck_Report(FILE* pFILE);
+
+//marks a scope, typically the body of the audio callback
+class SpiRtCheckScope
+{
+public:
+	SpiRtCheckScope() { SpiRtCheck_Enter(); }
+	~SpiRtCheckScope() { SpiRtCheck_Leave(); }
+};
+
+#if SPIRTCHECK_ENABLED
+#define SPIRTCHECK_SCOPE()	SpiRtCheckScope spirtcheckscope
+#else
+#define SPIRTCHECK_SCOPE()
+#endif
+
+#endif //_SPIRTCHECK_H
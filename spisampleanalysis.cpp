@@ -0,0 +1,302 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "stdafx.h"
+
+#include <windows.h>
+#include <math.h>
+#include <vector>
+
+#include "spisampleanalysis.h"
+
+using namespace std;
+
+void SpiSampleAnalysis_Analyze(const float* data, long frames, int samplerate,
+	float leadingthreshold_db, float trailingthreshold_db, SpiSampleAnalysis* panalysis)
+{
+	SpiSampleAnalysis& analysis = *panalysis;
+	double sum[2] = { 0.0, 0.0 };
+	float peak = 0.0f;
+	for (long i = 0; i < frames; i++)
+	{
+		float left = data[2 * i];
+		float right = data[2 * i + 1];
+		sum[0] += left;
+		sum[1] += right;
+		if (fabsf(left) > peak) peak = fabsf(left);
+		if (fabsf(right) > peak) peak = fabsf(right);
+	}
+	analysis.peak = peak;
+	analysis.dcoffset[0] = (frames > 0) ? (float)(sum[0] / frames) : 0.0f;
+	analysis.dcoffset[1] = (frames > 0) ? (float)(sum[1] / frames) : 0.0f;
+	analysis.frames = frames;
+	analysis.onsetframe = 0;
+	analysis.firstframe = 0;
+	analysis.lastframe = frames;
+
+	if (peak > 0.0f)
+	{
+		//onset, the first frame over the leading threshold
+		float leadinglevel = peak * powf(10.0f, leadingthreshold_db / 20.0f);
+		long onset = 0;
+		while (onset < frames && fabsf(data[2 * onset]) < leadinglevel && fabsf(data[2 * onset + 1]) < leadinglevel) onset++;
+		analysis.onsetframe = onset;
+		if (leadingthreshold_db < 0.0f)
+		{
+			long preroll = (long)(SPISAMPLEANALYSIS_PREROLL_S * samplerate);
+			analysis.firstframe = (onset > preroll) ? onset - preroll : 0;
+		}
+
+		//end of the tail, the last frame over the trailing threshold
+		if (trailingthreshold_db < 0.0f)
+		{
+			float trailinglevel = peak * powf(10.0f, trailingthreshold_db / 20.0f);
+			long last = frames - 1;
+			while (last > analysis.firstframe && fabsf(data[2 * last]) < trailinglevel && fabsf(data[2 * last + 1]) < trailinglevel) last--;
+			long end = last + 1 + (long)(SPISAMPLEANALYSIS_FADEOUT_S * samplerate);
+			analysis.lastframe = (end < frames) ? end : frames;
+		}
+	}
+
+	double sumofsquares = 0.0;
+	for (long i = 2 * analysis.firstframe; i < 2 * analysis.lastframe; i++)
+	{
+		sumofsquares += data[i] * data[i];
+	}
+	long keptframes = analysis.lastframe - analysis.firstframe;
+	analysis.rms = (keptframes > 0) ? (float)sqrt(sumofsquares / (2.0 * keptframes)) : 0.0f;
+}
+
+//left plus right over the window centered on frame
+static void SpiSampleAnalysis_Energy(const float* data, long frame, long halfwindow, double* penergy)
+{
+	double energy = 0.0;
+	for (long i = frame - halfwindow; i < frame + halfwindow; i++)
+	{
+		float mono = data[2 * i] + data[2 * i + 1];
+		energy += mono * mono;
+	}
+	*penergy = energy;
+}
+
+static bool SpiSampleAnalysis_IsUpwardZeroCrossing(const float* data, long frame)
+{
+	return (data[2 * (frame - 1)] + data[2 * (frame - 1) + 1]) < 0.0f && (data[2 * frame] + data[2 * frame + 1]) >= 0.0f;
+}
+
+void SpiSampleAnalysis_FindLoop(const float* data, long frames, int samplerate, SpiSampleLoop* ploop)
+{
+	SpiSampleLoop& loop = *ploop;
+	loop.loopstart = 0;
+	loop.loopend = 0;
+	loop.correlation = 0.0f;
+
+	long halfwindow = (long)(SPISAMPLEANALYSIS_LOOPWINDOW_S * samplerate / 2);
+	long crossfade = (long)(SPISAMPLEANALYSIS_LOOPCROSSFADE_S * samplerate);
+	long minloop = (long)(SPISAMPLEANALYSIS_LOOPMIN_S * samplerate);
+	long maxloop = (long)(SPISAMPLEANALYSIS_LOOPMAX_S * samplerate);
+
+	//the sustain region starts once the attack is over
+	long peakframe = 0;
+	float peak = 0.0f;
+	for (long i = 0; i < frames; i++)
+	{
+		float mono = fabsf(data[2 * i] + data[2 * i + 1]);
+		if (mono > peak)
+		{
+			peak = mono;
+			peakframe = i;
+		}
+	}
+	if (peak == 0.0f) return;
+	long start = peakframe + (long)(SPISAMPLEANALYSIS_ATTACK_S * samplerate);
+	if (start < crossfade) start = crossfade;
+	if (start < halfwindow + 1) start = halfwindow + 1;
+	long lastend = frames - halfwindow; //the window around the loop end must fit
+	if (start + minloop >= lastend) return; //too short to loop
+	if (start + maxloop > lastend) maxloop = lastend - start;
+
+	//loop start at the first upward zero crossing of the sustain region
+	while (start < lastend - minloop && !SpiSampleAnalysis_IsUpwardZeroCrossing(data, start)) start++;
+	if (start >= lastend - minloop) return;
+	double startenergy;
+	SpiSampleAnalysis_Energy(data, start, halfwindow, &startenergy);
+	if (startenergy <= 0.0) return;
+
+	//loop end at the best matching upward zero crossing
+	double maxlevelchange = pow(10.0, SPISAMPLEANALYSIS_LOOPMAXLEVELCHANGE_DB / 10.0); //energy ratio
+	for (long end = start + minloop; end < start + maxloop; end++)
+	{
+		if (!SpiSampleAnalysis_IsUpwardZeroCrossing(data, end)) continue;
+		double endenergy;
+		SpiSampleAnalysis_Energy(data, end, halfwindow, &endenergy);
+		if (endenergy <= 0.0 || endenergy > startenergy * maxlevelchange || endenergy * maxlevelchange < startenergy) continue;
+		double product = 0.0;
+		for (long i = -halfwindow; i < halfwindow; i++)
+		{
+			product += (double)(data[2 * (start + i)] + data[2 * (start + i) + 1]) * (data[2 * (end + i)] + data[2 * (end + i) + 1]);
+		}
+		float correlation = (float)(product / sqrt(startenergy * endenergy));
+		if (correlation > loop.correlation)
+		{
+			loop.correlation = correlation;
+			loop.loopend = end;
+		}
+	}
+	if (loop.correlation < SPISAMPLEANALYSIS_LOOPMINCORRELATION)
+	{
+		loop.loopend = 0;
+		return;
+	}
+	loop.loopstart = start;
+}
+
+long SpiSampleAnalysis_CrossfadeLoop(float* data, const SpiSampleLoop& loop, int samplerate)
+{
+	long crossfade = (long)(SPISAMPLEANALYSIS_LOOPCROSSFADE_S * samplerate);
+	if (crossfade > loop.loopstart) crossfade = loop.loopstart;
+	if (crossfade > loop.loopend - loop.loopstart) crossfade = loop.loopend - loop.loopstart;
+	for (long i = 0; i < crossfade; i++)
+	{
+		//the last frame of the loop becomes the frame ahead of the loop start
+		float gain = (float)(i + 1) / (float)crossfade;
+		long end = loop.loopend - crossfade + i;
+		long start = loop.loopstart - crossfade + i;
+		data[2 * end] = data[2 * end] * (1.0f - gain) + data[2 * start] * gain;
+		data[2 * end + 1] = data[2 * end + 1] * (1.0f - gain) + data[2 * start + 1] * gain;
+	}
+	return crossfade;
+}
+
+struct SpiSampleAnalysisJobs;
+typedef void (*SpiSampleAnalysisJobFn)(SpiSampleAnalysisJobs* pjobs, int job);
+
+struct SpiSampleAnalysisJobs
+{
+	SpiSampleAnalysisJobFn jobfn;
+	const float* const* data;
+	const long* frames;
+	int count;
+	int samplerate;
+	float leadingthreshold_db;
+	float trailingthreshold_db;
+	SpiSampleAnalysis* panalyses;
+	SpiSampleLoop* ploops;
+	volatile LONG nextjob;
+};
+
+static void SpiSampleAnalysis_RunJobs(SpiSampleAnalysisJobs* pjobs)
+{
+	LONG job;
+	while ((job = InterlockedIncrement(&pjobs->nextjob) - 1) < pjobs->count)
+	{
+		pjobs->jobfn(pjobs, (int)job);
+	}
+}
+
+static DWORD WINAPI SpiSampleAnalysis_ThreadProc(LPVOID lpParam)
+{
+	SpiSampleAnalysis_RunJobs((SpiSampleAnalysisJobs*)lpParam);
+	return 0;
+}
+
+//runs every job on one thread per core, the calling thread takes jobs too
+static void SpiSampleAnalysis_RunParallel(SpiSampleAnalysisJobs* pjobs)
+{
+	pjobs->nextjob = 0;
+	SYSTEM_INFO mySYSTEM_INFO;
+	GetSystemInfo(&mySYSTEM_INFO);
+	int numberofthreads = (int)mySYSTEM_INFO.dwNumberOfProcessors - 1;
+	if (numberofthreads > pjobs->count - 1) numberofthreads = pjobs->count - 1;
+	vector<HANDLE> threads;
+	for (int i = 0; i < numberofthreads; i++)
+	{
+		HANDLE hThread = CreateThread(NULL, 0, SpiSampleAnalysis_ThreadProc, pjobs, 0, NULL);
+		if (hThread == NULL) break;
+		threads.push_back(hThread);
+	}
+	SpiSampleAnalysis_RunJobs(pjobs);
+	if (!threads.empty())
+	{
+		WaitForMultipleObjects((DWORD)threads.size(), &threads[0], TRUE, INFINITE);
+		for (unsigned int i = 0; i < threads.size(); i++)
+		{
+			CloseHandle(threads[i]);
+		}
+	}
+}
+
+static void SpiSampleAnalysis_AnalyzeJob(SpiSampleAnalysisJobs* pjobs, int job)
+{
+	SpiSampleAnalysis_Analyze(pjobs->data[job], pjobs->frames[job], pjobs->samplerate,
+		pjobs->leadingthreshold_db, pjobs->trailingthreshold_db, &pjobs->panalyses[job]);
+}
+
+void SpiSampleAnalysis_AnalyzeAll(const float* const* data, const long* frames, int count, int samplerate,
+	float leadingthreshold_db, float trailingthreshold_db, SpiSampleAnalysis* panalyses)
+{
+	SpiSampleAnalysisJobs jobs;
+	jobs.jobfn = SpiSampleAnalysis_AnalyzeJob;
+	jobs.data = data;
+	jobs.frames = frames;
+	jobs.count = count;
+	jobs.samplerate = samplerate;
+	jobs.leadingthreshold_db = leadingthreshold_db;
+	jobs.trailingthreshold_db = trailingthreshold_db;
+	jobs.panalyses = panalyses;
+	jobs.ploops = NULL;
+	SpiSampleAnalysis_RunParallel(&jobs);
+}
+
+static void SpiSampleAnalysis_FindLoopJob(SpiSampleAnalysisJobs* pjobs, int job)
+{
+	SpiSampleAnalysis_FindLoop(pjobs->data[job], pjobs->frames[job], pjobs->samplerate, &pjobs->ploops[job]);
+}
+
+void SpiSampleAnalysis_FindLoopsAll(const float* const* data, const long* frames, int count, int samplerate, SpiSampleLoop* ploops)
+{
+	SpiSampleAnalysisJobs jobs;
+	jobs.jobfn = SpiSampleAnalysis_FindLoopJob;
+	jobs.data = data;
+	jobs.frames = frames;
+	jobs.count = count;
+	jobs.samplerate = samplerate;
+	jobs.leadingthreshold_db = 0.0f;
+	jobs.trailingthreshold_db = 0.0f;
+	jobs.panalyses = NULL;
+	jobs.ploops = ploops;
+	SpiSampleAnalysis_RunParallel(&jobs);
+}
+
+void SpiSampleAnalysis_FadeOut(float* data, long frames, long fadeframes)
+{
+	if (fadeframes > frames) fadeframes = frames;
+	for (long i = 0; i < fadeframes; i++)
+	{
+		float gain = (float)(fadeframes - 1 - i) / (float)fadeframes;
+		long frame = frames - fadeframes + i;
+		data[2 * frame] *= gain;
+		data[2 * frame + 1] *= gain;
+	}
+}
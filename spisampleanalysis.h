@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _SPISAMPLEANALYSIS_H
+#define _SPISAMPLEANALYSIS_H
+
+#define SPISAMPLEANALYSIS_PREROLL_S		0.002 //kept ahead of the onset so the attack transient is not clipped
+#define SPISAMPLEANALYSIS_FADEOUT_S		0.010 //ramp applied to the new end of a tail trimmed sample
+
+#define SPISAMPLEANALYSIS_ATTACK_S			0.150 //skipped after the peak before a loop can start
+#define SPISAMPLEANALYSIS_LOOPMIN_S			0.250 //shortest and longest sustain loop
+#define SPISAMPLEANALYSIS_LOOPMAX_S			1.000
+#define SPISAMPLEANALYSIS_LOOPWINDOW_S		0.030 //compared around the loop start and the loop end
+#define SPISAMPLEANALYSIS_LOOPCROSSFADE_S	0.050 //baked ahead of the loop end
+#define SPISAMPLEANALYSIS_LOOPRELEASE_S		0.200 //kept after the loop end, played once the gate is released
+#define SPISAMPLEANALYSIS_LOOPMINCORRELATION	0.8f //weaker matches are not looped
+#define SPISAMPLEANALYSIS_LOOPMAXLEVELCHANGE_DB	3.0f //a sound decaying faster than this over the loop is not sustained
+
+//level analysis of one stereo interleaved note table, levels are linear (1.0 full scale)
+struct SpiSampleAnalysis
+{
+	float peak; //largest absolute sample of either channel
+	float rms; //over the frames kept, both channels
+	float dcoffset[2]; //mean of each channel over the whole sample
+	long onsetframe; //first frame over the leading threshold, in the untrimmed sample
+	long firstframe; //first frame kept, onsetframe minus the pre-roll
+	long lastframe; //one past the last frame kept
+	long frames; //untrimmed length
+};
+
+//finds the frames to keep: the sample starts SPISAMPLEANALYSIS_PREROLL_S ahead of the first
+//frame over leadingthreshold_db and ends SPISAMPLEANALYSIS_FADEOUT_S after the last frame over
+//trailingthreshold_db. thresholds are in dB below the sample's own peak, 0 keeps that end as is.
+void SpiSampleAnalysis_Analyze(const float* data, long frames, int samplerate,
+	float leadingthreshold_db, float trailingthreshold_db, SpiSampleAnalysis* panalysis);
+
+//sustain loop of a stereo interleaved note table, loopend is 0 when none was found
+struct SpiSampleLoop
+{
+	long loopstart;
+	long loopend; //one past the last frame of the loop
+	float correlation; //of the signal around loopstart and loopend, 1.0 for a perfect match
+};
+
+//same for count samples at once, spread over one thread per core
+void SpiSampleAnalysis_AnalyzeAll(const float* const* data, const long* frames, int count, int samplerate,
+	float leadingthreshold_db, float trailingthreshold_db, SpiSampleAnalysis* panalyses);
+
+//looks for a loop in the sustain region, past the peak and its attack. the loop starts at an
+//upward zero crossing and ends at the upward zero crossing whose surroundings correlate best
+//with the loop start (autocorrelation at the zero crossing lags), within the loop length bounds.
+void SpiSampleAnalysis_FindLoop(const float* data, long frames, int samplerate, SpiSampleLoop* ploop);
+
+//same for count samples at once, spread over one thread per core
+void SpiSampleAnalysis_FindLoopsAll(const float* const* data, const long* frames, int count, int samplerate, SpiSampleLoop* ploops);
+
+//crossfades the frames ahead of the loop end with the frames ahead of the loop start, so the
+//jump from the loop end back to the loop start is seamless. returns the crossfade length.
+long SpiSampleAnalysis_CrossfadeLoop(float* data, const SpiSampleLoop& loop, int samplerate);
+
+//linear fade to zero over the last fadeframes frames of a stereo interleaved table
+void SpiSampleAnalysis_FadeOut(float* data, long frames, long fadeframes);
+
+#endif //_SPISAMPLEANALYSIS_H
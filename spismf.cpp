@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "stdafx.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#include "spismf.h"
+
+#define SPISMF_DEFAULTTEMPO	500000 //microseconds per quarter note, 120 bpm
+
+//event of any track at its absolute tick, tempo changes included
+struct SpiSmfTickEvent
+{
+	unsigned long tick;
+	int order; //position in the file, keeps the sort stable
+	bool tempo;
+	unsigned long microsecondsperquarter;
+	SpiSmfEvent event;
+};
+
+static bool SpiSmfTickEventLess(const SpiSmfTickEvent& a, const SpiSmfTickEvent& b)
+{
+	if (a.tick != b.tick) return a.tick < b.tick;
+	return a.order < b.order;
+}
+
+static unsigned long SpiSmfReadBigEndian(const unsigned char* p, int numberofbytes)
+{
+	unsigned long value = 0;
+	for (int i = 0; i < numberofbytes; i++) value = (value << 8) | p[i];
+	return value;
+}
+
+//variable length quantity, false when it runs past the end of the track
+static bool SpiSmfReadVariableLength(const unsigned char*& p, const unsigned char* end, unsigned long& value)
+{
+	value = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		if (p >= end) return false;
+		unsigned char byte = *p++;
+		value = (value << 7) | (byte & 0x7f);
+		if ((byte & 0x80) == 0) return true;
+	}
+	return false;
+}
+
+static bool SpiSmfParseTrack(const unsigned char* p, const unsigned char* end, vector<SpiSmfTickEvent>& tickevents)
+{
+	unsigned long tick = 0;
+	unsigned char runningstatus = 0;
+	while (p < end)
+	{
+		unsigned long delta;
+		if (!SpiSmfReadVariableLength(p, end, delta)) return false;
+		tick += delta;
+		if (p >= end) return false;
+
+		unsigned char status = *p;
+		if (status == 0xff)
+		{
+			//meta event, only the tempo is kept
+			if (p + 2 > end) return false;
+			unsigned char type = p[1];
+			p += 2;
+			unsigned long length;
+			if (!SpiSmfReadVariableLength(p, end, length) || p + length > end) return false;
+			if (type == 0x51 && length == 3)
+			{
+				SpiSmfTickEvent tickevent;
+				memset(&tickevent, 0, sizeof(tickevent));
+				tickevent.tick = tick;
+				tickevent.order = (int)tickevents.size();
+				tickevent.tempo = true;
+				tickevent.microsecondsperquarter = SpiSmfReadBigEndian(p, 3);
+				tickevents.push_back(tickevent);
+			}
+			p += length;
+			if (type == 0x2f) break; //end of track
+			continue;
+		}
+		if (status == 0xf0 || status == 0xf7)
+		{
+			//system exclusive, skipped
+			p++;
+			unsigned long length;
+			if (!SpiSmfReadVariableLength(p, end, length) || p + length > end) return false;
+			p += length;
+			continue;
+		}
+
+		if (status & 0x80)
+		{
+			runningstatus = status;
+			p++;
+		}
+		else if (runningstatus == 0)
+		{
+			return false; //data byte without a status
+		}
+		int command = runningstatus & 0xf0;
+		int numberofdatabytes = (command == 0xc0 || command == 0xd0) ? 1 : 2;
+		if (p + numberofdatabytes > end) return false;
+
+		SpiSmfTickEvent tickevent;
+		memset(&tickevent, 0, sizeof(tickevent));
+		tickevent.tick = tick;
+		tickevent.order = (int)tickevents.size();
+		tickevent.tempo = false;
+		tickevent.event.status = runningstatus;
+		tickevent.event.data1 = p[0] & 0x7f;
+		tickevent.event.data2 = (numberofdatabytes == 2) ? (p[1] & 0x7f) : 0;
+		tickevents.push_back(tickevent);
+		p += numberofdatabytes;
+	}
+	return true;
+}
+
+bool SpiSmf_Load(const char* filename, vector<SpiSmfEvent>& events)
+{
+	events.clear();
+	FILE* pFile = fopen(filename, "rb");
+	if (pFile == NULL) return false;
+	vector<unsigned char> data;
+	unsigned char chunk[4096];
+	size_t count;
+	while ((count = fread(chunk, 1, sizeof(chunk), pFile)) > 0) data.insert(data.end(), chunk, chunk + count);
+	fclose(pFile);
+
+	//header chunk
+	if (data.size() < 14 || memcmp(&data[0], "MThd", 4) != 0) return false;
+	unsigned long headerlength = SpiSmfReadBigEndian(&data[4], 4);
+	int format = (int)SpiSmfReadBigEndian(&data[8], 2);
+	int numberoftracks = (int)SpiSmfReadBigEndian(&data[10], 2);
+	int division = (int)SpiSmfReadBigEndian(&data[12], 2);
+	if (format > 1 || division == 0) return false;
+
+	//track chunks, other chunk types are skipped
+	vector<SpiSmfTickEvent> tickevents;
+	size_t position = 8 + headerlength;
+	for (int track = 0; track < numberoftracks && position + 8 <= data.size();)
+	{
+		unsigned long length = SpiSmfReadBigEndian(&data[position + 4], 4);
+		if (position + 8 + length > data.size()) return false;
+		if (memcmp(&data[position], "MTrk", 4) == 0)
+		{
+			const unsigned char* begin = &data[position + 8];
+			if (!SpiSmfParseTrack(begin, begin + length, tickevents)) return false;
+			track++;
+		}
+		position += 8 + length;
+	}
+	stable_sort(tickevents.begin(), tickevents.end(), SpiSmfTickEventLess);
+
+	//ticks to seconds through the tempo map, smpte divisions have a fixed tick duration
+	double secondspertick;
+	bool smpte = (division & 0x8000) != 0;
+	if (smpte)
+	{
+		int framespersecond = -(signed char)(division >> 8);
+		int ticksperframe = division & 0xff;
+		secondspertick = 1.0 / ((double)framespersecond * ticksperframe);
+	}
+	else
+	{
+		secondspertick = SPISMF_DEFAULTTEMPO / 1000000.0 / division;
+	}
+	double time_s = 0.0;
+	unsigned long lasttick = 0;
+	for (unsigned int i = 0; i < tickevents.size(); i++)
+	{
+		SpiSmfTickEvent& tickevent = tickevents[i];
+		time_s += (tickevent.tick - lasttick) * secondspertick;
+		lasttick = tickevent.tick;
+		if (tickevent.tempo)
+		{
+			if (!smpte) secondspertick = tickevent.microsecondsperquarter / 1000000.0 / division;
+			continue;
+		}
+		tickevent.event.time_s = time_s;
+		events.push_back(tickevent.event);
+	}
+	return true;
+}
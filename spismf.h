@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _SPISMF_H
+#define _SPISMF_H
+
+#include <vector>
+
+using namespace std;
+
+//one channel voice message of a standard midi file, at its time in seconds
+struct SpiSmfEvent
+{
+	double time_s;
+	unsigned char status; //command in the high nibble, channel in the low nibble
+	unsigned char data1;
+	unsigned char data2;
+};
+
+//reads a format 0 or 1 standard midi file, returns its channel voice messages sorted
+//by time with the tempo map applied. meta and system exclusive events are skipped.
+bool SpiSmf_Load(const char* filename, vector<SpiSmfEvent>& events);
+
+#endif //_SPISMF_H
@@ -0,0 +1,392 @@
+/*
+ * Copyright (c) 2015-2016 Stephane Poirier
+ *
+ * stephane.poirier@oifii.org
+ *
+ * Stephane Poirier
+ * 3532 rue Ste-Famille, #3
+ * Montreal, QC, H2X 2L1
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+////////////////////////////////////////////////////////////////
+//nakedsoftware.org, spi@oifii.org or stephane.poirier@oifii.org
+//
+//spitonicbenchmark.cpp, console benchmark of the sampler voice render path
+//
+//renders the same module graphs as spitonicmidiinstrumentpolysamplerswin32,
+//one PolySynth per module summed by a SummingBus, for 1 to 16 modules and 8 to
+//128 voices per module, at buffer sizes of 32 to 2048 frames. both voice engines
+//are measured, the tonic synth graph per voice (SuperBufferPlayer, ADSR and
+//multiplier, as built by createSynthVoice()) and the native PolySampler.
+//synthetic note tables are generated so no sample library is needed.
+//
+//engine 3 runs the denormal test instead, a burst into a feedback delay and a reverb
+//followed by silence, with the render time of each second of the decaying tail for
+//the default floating point mode, FTZ/DAZ and the anti-denormal dc.
+//
+//usage: spitonicbenchmark [engine] [activenotes] [seconds] [maxmodules] [maxvoices] [csvfile]
+//	engine		0 graph, 1 sampler, 2 both (default), 3 denormal test
+//	activenotes	notes held per module, 0 for one per voice (default)
+//	seconds		seconds of audio rendered per measurement (default 2)
+//	maxmodules	largest module count measured (default 16)
+//	maxvoices	largest voice count per module measured (default 128)
+//	csvfile		optional, one line per measurement for comparing runs
+//
+//nakedsoftware.org, spi@oifii.org or stephane.poirier@oifii.org
+////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "Tonic.h"
+#include "PolySynth.h"
+#include "PolySampler.h"
+#include "SuperBufferPlayer.h"
+#include "SummingBus.h"
+#include "spirtcheck.h"
+#include "spidenormal.h"
+using namespace Tonic;
+
+#define BENCHMARK_SAMPLE_RATE		(44100)
+#define BENCHMARK_NUM_CHANNELS		(2)
+#define BENCHMARK_MAXNUMBEROFMODULES	(16)
+#define BENCHMARK_MAXBUFFERSIZE		(2048)
+#define BENCHMARK_NOTE_S			(2.0f)	//length of the synthetic note tables
+#define BENCHMARK_RETRIGGER_S		(1.0f)	//notes are retriggered before they reach the end of their table
+#define BENCHMARK_WARMUP_S			(0.25f)	//rendered before each measurement, not timed
+#define BENCHMARK_CPU_BUDGET		(0.7)	//fraction of the buffer period the render may use, the rest is left to the driver and the os
+#define BENCHMARK_BURST_S			(0.1f)	//input of the denormal test, silence follows
+#define BENCHMARK_TAIL_S			(12)	//long enough for the feedback tails to go below the normal float range
+#define BENCHMARK_TAIL_FRAMES_PER_BUFFER	(224)
+
+SuperBufferPlayer* global_psuperplayer[BENCHMARK_MAXNUMBEROFMODULES]; //used by PolySynth.cpp
+SuperBufferKeymapSlot global_benchmarkkeymapslot[BENCHMARK_MAXNUMBEROFMODULES];
+SampleTable* global_benchmarktables[POLYSAMPLER_NUMBEROFNOTES];
+int global_benchmarkmoduleindex = 0;
+int global_benchmarkvoiceindex[BENCHMARK_MAXNUMBEROFMODULES];
+float global_benchmarkbuffer[BENCHMARK_MAXBUFFERSIZE * BENCHMARK_NUM_CHANNELS];
+
+const char* global_enginenames[] = { "graph", "sampler" };
+int global_numberofmodules[] = { 1, 2, 4, 8, 16 };
+int global_numberofvoices[] = { 8, 16, 32, 64, 128 };
+int global_buffersizes[] = { 32, 64, 128, 224, 512, 2048 };
+
+//one stereo sine per midi note with a slow decay, only the notes that are played get full length tables
+void createBenchmarkNoteTables(int firstnote, int numberofnotes)
+{
+	for (int note = 0; note < POLYSAMPLER_NUMBEROFNOTES; note++)
+	{
+		bool played = (note >= firstnote && note < firstnote + numberofnotes);
+		unsigned int frames = played ? (unsigned int)(BENCHMARK_NOTE_S * BENCHMARK_SAMPLE_RATE) : kSynthesisBlockSize;
+		global_benchmarktables[note] = new SampleTable(frames, 2);
+		float* data = global_benchmarktables[note]->dataPointer();
+		double frequency = 440.0 * pow(2.0, (note - 69) / 12.0);
+		for (unsigned int i = 0; i < frames; i++)
+		{
+			float value = 0.1f * (float)(sin(2.0 * 3.14159265358979 * frequency * i / BENCHMARK_SAMPLE_RATE) * exp(-(double)i / BENCHMARK_SAMPLE_RATE));
+			data[2 * i] = value;
+			data[2 * i + 1] = value;
+		}
+	}
+}
+
+void deleteBenchmarkNoteTables()
+{
+	for (int note = 0; note < POLYSAMPLER_NUMBEROFNOTES; note++)
+	{
+		delete global_benchmarktables[note];
+	}
+}
+
+//same graph as createSynthVoice() in spitonicmidiinstrumentpolysamplerswin32.cpp
+//Synth createBenchmarkVoice()
+PolyVoiceSynth createBenchmarkVoice()
+{
+	global_benchmarkvoiceindex[global_benchmarkmoduleindex]++;
+	Synth newSynth;
+
+	ControlParameter noteNum = newSynth.addParameter("polyNote", 0.0);
+	ControlParameter gate = newSynth.addParameter("polyGate", 0.0);
+	ControlParameter noteVelocity = newSynth.addParameter("polyVelocity", 0.0);
+	ControlParameter voiceNumber = newSynth.addParameter("polyVoiceNumber", 0.0);
+
+	Generator tone = global_psuperplayer[global_benchmarkmoduleindex][global_benchmarkvoiceindex[global_benchmarkmoduleindex]].setBuffer(noteNum).trigger(gate);
+
+	ADSR env = ADSR()
+		.attack(0.04)
+		.decay(0.1)
+		.sustain(0.8)
+		.release(0.0)
+		.doesSustain(true)
+		.trigger(gate);
+
+	newSynth.setOutputGen(tone * env);
+
+	//the allocator writes the note events through these handles
+	PolyVoiceSynth voiceSynth;
+	voiceSynth.synth = newSynth;
+	voiceSynth.note = noteNum;
+	voiceSynth.gate = gate;
+	voiceSynth.velocity = noteVelocity;
+	voiceSynth.voiceNumber = voiceNumber;
+	return voiceSynth;
+}
+
+//the modules of one measurement, built once and rendered at every buffer size
+class BenchmarkModules
+{
+public:
+	BenchmarkModules(int engine, int numberofmodules, int numberofvoices)
+		: numberofmodules_(numberofmodules)
+	{
+		poly_ = new PolySynth[numberofmodules];
+		for (int m = 0; m < numberofmodules; m++)
+		{
+			if (engine == 0)
+			{
+				global_psuperplayer[m] = new SuperBufferPlayer[numberofvoices];
+				global_benchmarkkeymapslot[m].setKeymap(new SuperBufferKeymap(global_benchmarktables));
+				for (int v = 0; v < numberofvoices; v++) global_psuperplayer[m][v].setKeymapSlot(&global_benchmarkkeymapslot[m]);
+				global_benchmarkmoduleindex = m;
+				global_benchmarkvoiceindex[m] = -1;
+				poly_[m].addVoices(createBenchmarkVoice, numberofvoices);
+			}
+			else
+			{
+				PolySampler sampler;
+				sampler.attack(0.04).decay(0.1).sustain(0.8).release(0.0).setNoteTables(global_benchmarktables);
+				poly_[m].setSampler(sampler, numberofvoices);
+			}
+			bus_.addInput(poly_[m]);
+		}
+		synth_.setOutputGen(bus_);
+		ownsplayers_ = (engine == 0);
+	}
+
+	~BenchmarkModules()
+	{
+		synth_.setOutputGen(Generator());
+		delete[] poly_;
+		if (ownsplayers_)
+		{
+			for (int m = 0; m < numberofmodules_; m++)
+			{
+				delete[] global_psuperplayer[m];
+				global_benchmarkkeymapslot[m].clear();
+			}
+		}
+	}
+
+	//holds activenotes notes per module, released and retriggered together
+	void retrigger(int activenotes, int firstnote, int numberofnotes)
+	{
+		for (int m = 0; m < numberofmodules_; m++)
+		{
+			for (int n = 0; n < activenotes; n++) poly_[m].noteOff(m, firstnote + (n % numberofnotes));
+			for (int n = 0; n < activenotes; n++) poly_[m].noteOn(m, firstnote + (n % numberofnotes), 100);
+		}
+	}
+
+	//renders numberofframes frames in buffers of buffersize frames, returns the render time in seconds
+	double render(unsigned int buffersize, unsigned int numberofframes, int activenotes, int firstnote, int numberofnotes)
+	{
+		unsigned int retriggerframes = (unsigned int)(BENCHMARK_RETRIGGER_S * BENCHMARK_SAMPLE_RATE);
+		unsigned int nextretrigger = 0;
+
+		LARGE_INTEGER frequency, start, stop;
+		QueryPerformanceFrequency(&frequency);
+		QueryPerformanceCounter(&start);
+		SpiRtCheck_Enter(); //same work as the audio callback, note events included
+		for (unsigned int frame = 0; frame < numberofframes; frame += buffersize)
+		{
+			if (frame >= nextretrigger)
+			{
+				retrigger(activenotes, firstnote, numberofnotes);
+				nextretrigger += retriggerframes;
+			}
+			synth_.fillBufferOfFloats(global_benchmarkbuffer, buffersize, BENCHMARK_NUM_CHANNELS);
+		}
+		SpiRtCheck_Leave();
+		QueryPerformanceCounter(&stop);
+		return (double)(stop.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+	}
+
+protected:
+	int numberofmodules_;
+	bool ownsplayers_;
+	PolySynth* poly_;
+	SummingBus bus_;
+	Synth synth_;
+};
+
+//burst then silence through feedback effects, render time of each second of audio in seconds.
+//mode 0 leaves the mxcsr as it is, 1 sets FTZ/DAZ, 2 adds the anti-denormal dc instead.
+void renderDenormalTail(int mode, double* seconds)
+{
+	unsigned int mxcsr = _mm_getcsr();
+	if (mode == 1) SpiDenormal_DisableOnThisThread();
+	else _mm_setcsr(mxcsr & ~(SPIDENORMAL_FTZ | SPIDENORMAL_DAZ));
+
+	Synth synth;
+	ControlParameter gain = synth.addParameter("gain", 1.0);
+	Generator input = Noise() * 0.5f * gain;
+	if (mode == 2) input = input + FixedValue(SPIDENORMAL_ANTIDENORMAL);
+	//the master delay of the app with short delay times so its tail reaches denormals within seconds
+	StereoDelay delay = StereoDelay(0.02f, 0.03f)
+		.feedback(0.7)
+		.dryLevel(0.8)
+		.wetLevel(0.2);
+	Reverb reverb = Reverb()
+		.decayTime(0.5f)
+		.dryLevel(1.0f)
+		.wetLevel(0.3f);
+	synth.setOutputGen((input >> delay) >> reverb);
+
+	unsigned int buffersize = BENCHMARK_TAIL_FRAMES_PER_BUFFER;
+	unsigned int framespersecond = (BENCHMARK_SAMPLE_RATE / buffersize) * buffersize;
+	LARGE_INTEGER frequency, start, stop;
+	QueryPerformanceFrequency(&frequency);
+	for (int second = 0; second < BENCHMARK_TAIL_S; second++)
+	{
+		QueryPerformanceCounter(&start);
+		for (unsigned int frame = 0; frame < framespersecond; frame += buffersize)
+		{
+			if (second == 0 && frame >= BENCHMARK_BURST_S * BENCHMARK_SAMPLE_RATE) synth.setParameter("gain", 0.0f);
+			synth.fillBufferOfFloats(global_benchmarkbuffer, buffersize, BENCHMARK_NUM_CHANNELS);
+		}
+		QueryPerformanceCounter(&stop);
+		seconds[second] = (double)(stop.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+	}
+	SpiDenormal_Restore(mxcsr);
+}
+
+void runDenormalBenchmark()
+{
+	const char* modenames[] = { "default", "ftz/daz", "dc" };
+	double seconds[3][BENCHMARK_TAIL_S];
+	for (int mode = 0; mode < 3; mode++) renderDenormalTail(mode, seconds[mode]);
+
+	unsigned int framespersecond = (BENCHMARK_SAMPLE_RATE / BENCHMARK_TAIL_FRAMES_PER_BUFFER) * BENCHMARK_TAIL_FRAMES_PER_BUFFER;
+	printf("denormal test, %.1f s burst then silence into a feedback delay and a reverb, ns/frame per second of audio\n\n", BENCHMARK_BURST_S);
+	printf("%6s %10s %10s %10s\n", "second", modenames[0], modenames[1], modenames[2]);
+	for (int second = 0; second < BENCHMARK_TAIL_S; second++)
+	{
+		printf("%6d", second);
+		for (int mode = 0; mode < 3; mode++) printf(" %10.2f", seconds[mode][second] * 1e9 / framespersecond);
+		printf("\n");
+	}
+}
+
+//ns per frame and per voice-frame, and the voices that fit in BENCHMARK_CPU_BUDGET of one core at 44.1 kHz.
+//the 48 kHz column is an estimate, the 44.1 kHz timing rescaled, tonic runs at BENCHMARK_SAMPLE_RATE only
+void printBenchmarkResult(FILE* pCSV, int engine, int numberofmodules, int numberofvoices, int buffersize, int numberofactivevoices, unsigned int numberofframes, double seconds)
+{
+	double nsperframe = seconds * 1e9 / numberofframes;
+	double nspervoiceframe = nsperframe / numberofactivevoices;
+	int maxpolyphony44 = (int)(BENCHMARK_CPU_BUDGET * 1e9 / 44100.0 / nspervoiceframe);
+	int maxpolyphony48 = (int)(BENCHMARK_CPU_BUDGET * 1e9 / 48000.0 / nspervoiceframe);
+	double realtime = ((double)numberofframes / BENCHMARK_SAMPLE_RATE) / seconds;
+	printf("%-8s %7d %6d %6d %6d %10.2f %10.3f %8.1fx %8d %8d\n",
+		global_enginenames[engine], numberofmodules, numberofvoices, buffersize, numberofactivevoices,
+		nsperframe, nspervoiceframe, realtime, maxpolyphony44, maxpolyphony48);
+	if (pCSV)
+	{
+		fprintf(pCSV, "%s,%d,%d,%d,%d,%.3f,%.4f,%.2f,%d,%d\n",
+			global_enginenames[engine], numberofmodules, numberofvoices, buffersize, numberofactivevoices,
+			nsperframe, nspervoiceframe, realtime, maxpolyphony44, maxpolyphony48);
+		fflush(pCSV);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	int engines = 2;
+	int activenotes = 0;
+	float render_s = 2.0f;
+	int maxmodules = BENCHMARK_MAXNUMBEROFMODULES;
+	int maxvoices = POLYSAMPLER_MAXNUMBEROFVOICES;
+	FILE* pCSV = NULL;
+	if (argc > 1) engines = atoi(argv[1]);
+	if (argc > 2) activenotes = atoi(argv[2]);
+	if (argc > 3) render_s = (float)atof(argv[3]);
+	if (argc > 4) maxmodules = atoi(argv[4]);
+	if (argc > 5) maxvoices = atoi(argv[5]);
+	if (argc > 6)
+	{
+		pCSV = fopen(argv[6], "w");
+		if (pCSV) fprintf(pCSV, "engine,modules,voices,buffer,activevoices,ns_per_frame,ns_per_voice_frame,realtime,maxpolyphony44100,maxpolyphony48000_estimated\n");
+	}
+
+	SpiRtCheck_Install();
+	Tonic::setSampleRate(BENCHMARK_SAMPLE_RATE);
+	if (engines == 3)
+	{
+		runDenormalBenchmark();
+		return 0;
+	}
+	SpiDenormal_DisableOnThisThread(); //as on the audio thread
+
+	const int firstnote = 36;
+	const int numberofnotes = 64;
+	createBenchmarkNoteTables(firstnote, numberofnotes);
+
+	printf("%.1f s of audio per measurement at %d Hz, %s active notes per module, cpu budget %.0f%%\n\n",
+		render_s, BENCHMARK_SAMPLE_RATE, activenotes > 0 ? argv[2] : "all voices as", BENCHMARK_CPU_BUDGET * 100.0);
+	printf("%-8s %7s %6s %6s %6s %10s %10s %9s %8s %8s\n",
+		"engine", "modules", "voices", "buffer", "active", "ns/frame", "ns/v-frame", "realtime", "max@44.1", "est@48");
+
+	for (int e = 0; e < 2; e++)
+	{
+		if (engines != 2 && engines != e) continue;
+		for (unsigned int i = 0; i < sizeof(global_numberofmodules) / sizeof(global_numberofmodules[0]); i++)
+		{
+			int numberofmodules = global_numberofmodules[i];
+			if (numberofmodules > maxmodules) break;
+			for (unsigned int j = 0; j < sizeof(global_numberofvoices) / sizeof(global_numberofvoices[0]); j++)
+			{
+				int numberofvoices = global_numberofvoices[j];
+				if (numberofvoices > maxvoices) break;
+				int notespermodule = (activenotes > 0 && activenotes < numberofvoices) ? activenotes : numberofvoices;
+				int numberofactivevoices = notespermodule * numberofmodules;
+
+				BenchmarkModules modules(e, numberofmodules, numberofvoices);
+				for (unsigned int k = 0; k < sizeof(global_buffersizes) / sizeof(global_buffersizes[0]); k++)
+				{
+					unsigned int buffersize = global_buffersizes[k];
+					//whole buffers only, within one buffer of the requested length
+					unsigned int numberofframes = ((unsigned int)(render_s * BENCHMARK_SAMPLE_RATE) / buffersize) * buffersize;
+					modules.render(buffersize, (unsigned int)(BENCHMARK_WARMUP_S * BENCHMARK_SAMPLE_RATE), notespermodule, firstnote, numberofnotes);
+					double seconds = modules.render(buffersize, numberofframes, notespermodule, firstnote, numberofnotes);
+					printBenchmarkResult(pCSV, e, numberofmodules, numberofvoices, buffersize, numberofactivevoices, numberofframes, seconds);
+				}
+			}
+			printf("\n");
+		}
+	}
+
+	deleteBenchmarkNoteTables();
+	if (pCSV) fclose(pCSV);
+
+#if SPIRTCHECK_ENABLED
+	//the render loops must not allocate, lock or do file i/o, fail the run if they did
+	SpiRtCheck_Report(stdout);
+	if (SpiRtCheck_GetTotalNumberOfViolations() > 0) return 1;
+#endif
+	return 0;
+}
@@ -89,18 +89,38 @@
 using namespace Tonic;
 
 #include "SuperBufferPlayer.h"
+#include "SummingBus.h"
+#include "PolySampler.h"
+#include "spirenderpool.h"
+#include "spimidieventqueue.h"
+#include "spilogring.h"
+#include "spirtcheck.h"
+#include "spiloadmeter.h"
+#include "spipolyphonygovernor.h"
+#include "spismf.h"
+#include "spiaudiobackend.h"
+#include <sndfile.hh>
 
 #include "smbPitchShift.h"
+#include "spiresample.h"
+#include "spisampleanalysis.h"
+#include "spinotearena.h"
+#include "spimemorylock.h"
+#include "spinotecache.h"
+#include "spidenormal.h"
 
 #include "spiutility.h"
 #include "spimidiutility.h"
 
-#define SAMPLE_RATE  (44100)
-#define FRAMES_PER_BUFFER (224) //#define FRAMES_PER_BUFFER (512) //#define FRAMES_PER_BUFFER (2048) //#define FRAMES_PER_BUFFER (64) 
+//#define SAMPLE_RATE  (44100)
+//#define FRAMES_PER_BUFFER (224) //#define FRAMES_PER_BUFFER (512) //#define FRAMES_PER_BUFFER (2048) //#define FRAMES_PER_BUFFER (64) 
+#define SPITMIPS_DEFAULTSAMPLERATE		(44100) //when neither the command line nor the audio device gives one
+#define SPITMIPS_DEFAULTFRAMESPERBUFFER	(224)
 //#define NUM_CHANNELS    (1)
 #define NUM_CHANNELS    (2)
 
 #define SPITMIPS_MAXNUMBEROFSAMPLERMODULES	16
+#define SPITMIPS_NUMBEROFVOICES	8 //per sampler module, also the fixed voice capacity of its allocator
 
 // Static smart pointer for our Synth
 /*
@@ -113,7 +133,15 @@ static Synth synth;
 //static SimpleInstrumentBufferPlayerSynth synth;
 //static SimpleInstrumentTableLookupSynth synth;
 //static SimpleInstrumentTableLookupSPEARSynth synth;
-static PolySynth poly[SPITMIPS_MAXNUMBEROFSAMPLERMODULES];
+//static PolySynth poly[SPITMIPS_MAXNUMBEROFSAMPLERMODULES];
+//static PolySynthWithAllocator<LowestNoteStealingPolyphonicAllocator, SPITMIPS_NUMBEROFVOICES> poly[SPITMIPS_MAXNUMBEROFSAMPLERMODULES];
+//voice stealing policy, the quietest voice goes first and fades out (native sampler) instead of a hard cut
+#define SPITMIPS_VOICEALLOCATOR	QuietestVoiceStealingPolyphonicAllocator
+static PolySynthWithAllocator<SPITMIPS_VOICEALLOCATOR, SPITMIPS_NUMBEROFVOICES> poly[SPITMIPS_MAXNUMBEROFSAMPLERMODULES];
+//global voice pool, one set of voices any sampler module can claim, replaces poly[] when enabled
+#define SPITMIPS_MAXVOICEPOOLSIZE	POLYSYNTH_MAXNUMBEROFVOICES
+typedef PolySynthWithAllocator<SPITMIPS_VOICEALLOCATOR, SPITMIPS_MAXVOICEPOOLSIZE> SpiVoicePool;
+static SpiVoicePool* global_pvoicepool = NULL;
 static Synth synth;
 //static SimpleInstrumentSineSumSynth synth;
 //static SimpleInstrumentBasicSynth synth;
@@ -235,9 +263,21 @@ SampleTable** global_ppbuffer[SPITMIPS_MAXNUMBEROFSAMPLERMODULES];
 //BufferPlayer* global_pplayer;
 const int SPITMIPS_NSAMPLES = 128; //for all the 128 midi notes
 float global_sampleduration_s[SPITMIPS_MAXNUMBEROFSAMPLERMODULES][SPITMIPS_NSAMPLES];
-
-const int SPITMIPS_NUMBEROFVOICES = 8;
+SpiSampleAnalysis global_sampleanalysis[SPITMIPS_MAXNUMBEROFSAMPLERMODULES][SPITMIPS_NSAMPLES]; //supplied samples only, for normalization
+float global_leadingsilence_db = -60.0f; //leading silence under this (dB below the sample peak) is trimmed at load time, 0 to keep it
+float global_trailingsilence_db = -70.0f; //same for the tail
+int global_sustainloops = 1; //1 to find a sustain loop in each note and keep the note table only up to the loop end plus a release (native sampler only)
+unsigned int global_noteloopstart[SPITMIPS_MAXNUMBEROFSAMPLERMODULES][SPITMIPS_NSAMPLES];
+unsigned int global_noteloopend[SPITMIPS_MAXNUMBEROFSAMPLERMODULES][SPITMIPS_NSAMPLES]; //0 for no loop
+SpiNoteArena global_notearena[SPITMIPS_MAXNUMBEROFSAMPLERMODULES]; //note data of the native sampler, one aligned block per module
+int global_samplememory = 1; //0 as allocated, 1 prefault the note tables after load, 2 prefault and lock them, 3 also large pages for the note arenas
+size_t global_samplememoryprefaulted = 0; //bytes, all modules
+size_t global_samplememorylocked = 0; //bytes, all modules
+
+//const int SPITMIPS_NUMBEROFVOICES = 8;
+const float SPITMIPS_VOICERELEASE_S = 0.0f; //adsr release, voices are skipped by the mixer once it has elapsed after note off
 SuperBufferPlayer* global_psuperplayer[SPITMIPS_MAXNUMBEROFSAMPLERMODULES];
+SuperBufferKeymapSlot global_keymapslot[SPITMIPS_MAXNUMBEROFSAMPLERMODULES]; //note tables of each module, shared by its buffer players
 
 const int SPITMIPS_MAXNUMSTAGE = 11;
 
@@ -254,6 +294,65 @@ int global_samplermodulesindex = -1;
 
 int voiceindex[SPITMIPS_MAXNUMBEROFSAMPLERMODULES];
 
+int global_renderthreads = 0; //0 for serial rendering, -1 for one worker per core, or number of render worker threads
+SpiRenderPool global_renderpool;
+SummingBus global_masterbus; //flat sum of all the sampler modules
+
+int global_samplerengine = 0; //0 for one tonic synth graph per voice, 1 for the native polysampler (experimental, not yet measured against the graph, see spitonicbenchmark)
+PolySampler global_polysampler[SPITMIPS_MAXNUMBEROFSAMPLERMODULES];
+int global_voicepoolsize = 0; //0 for SPITMIPS_NUMBEROFVOICES voices per module, else the number of voices shared by all the modules
+int global_voicepoolminvoices = 0; //voices each module is guaranteed from the pool
+int global_voicepoolmaxvoices = 0; //most voices one module can hold, 0 for the whole pool
+SuperBufferPlayer* global_ppoolsuperplayer = NULL; //graph voices of the pool, bound to a module's note bank at note on
+int global_poolvoiceindex = -1;
+int global_oneshotmodules = 0; //bit i set for sampler module i to ignore note offs, its notes play through (drums, one-shot samples)
+
+#define SPITMIPS_NOTECACHEFOLDER	"spitmips_notecache" //evicted note tables, emptied at exit
+#define SPITMIPS_NOTECACHEHEAD_S	0.25 //start of each cached note kept resident, played while the rest is reloaded
+int global_notecachebudget_mb = 0; //memory for the gap filled note tables of the native sampler, the least recently played ones are spilled to disk, 0 to keep them all resident
+SpiNoteCache global_notecache;
+
+//the native sampler and bank a module's notes are played from, for the note cache
+class SamplerNoteCacheClient : public SpiNoteCacheClient
+{
+public:
+	void publishNote(int module, int note, const float* data) { getSampler(module).setNoteDataPointer(getBank(module), note, data); }
+	long getBlockCount(int module) { return getSampler(module).getBlockCount(); }
+	long getNoteLastUsed(int module, int note) { return getSampler(module).getNoteLastUsed(getBank(module), note); }
+private:
+	PolySampler& getSampler(int module) { return global_polysampler[(global_voicepoolsize > 0) ? 0 : module]; }
+	int getBank(int module) { return (global_voicepoolsize > 0) ? module : 0; }
+};
+SamplerNoteCacheClient global_notecacheclient;
+
+SpiMidiEventQueue global_midieventqueue; //note events from the midi thread to the audio thread
+unsigned long global_renderedframes = 0; //frames rendered since the stream started, wraps on a synthesis block boundary
+
+#define SPITMIPS_LOGTIMER_ID				1
+#define SPITMIPS_LOGTIMER_MS				100 //log ring drained 10 times per second by the ui thread
+#define SPITMIPS_LOGMAXMESSAGESPERTICK		16 //midi monitor lines displayed per drain, the rest are only counted
+SpiLogRing global_logring; //midi monitor and note records, written by the midi and audio threads
+int global_verbosemonitor = 1; //0 to drop the midi monitor and note logging, 1 to keep them
+
+#define SPITMIPS_LOADTIMER_ID				2
+SpiLoadMeter global_loadmeter; //render callback duration against its deadline, xruns
+int global_loadmeterdisplay_s = 5; //seconds between two load lines in the status window, 0 for none
+#define SPITMIPS_POLYPHONYHYSTERESIS_PERCENT	20.0 //voices are given back under the governor threshold minus this
+SpiPolyphonyGovernor global_polyphonygovernor; //lowers the polyphony of every module when the callback nears its deadline
+double global_polyphonygovernorload = 0.0; //percent of the deadline that triggers the governor, 0 for no governor
+int global_polyphonygovernorminvoices = 2; //voices per module the governor never goes under
+
+const float SPITMIPS_OFFLINETAIL_S = 2.0f; //rendered after the last midi event, for releases and the delay
+string global_offlinemidifile = ""; //standard midi file to render offline, the app then runs headless
+string global_offlinewavfile = "offline.wav";
+
+int global_audiobackend = 0; //0 for portaudio, 1 for the null device (real rate, no audio hardware), 2 for the wav file sink
+string global_audiobackendfile = "backend.wav"; //output of the wav file sink
+int global_samplerate = 0; //0 for the output device's native rate, the samples are converted to it at load time
+int global_framesperbuffer = SPITMIPS_DEFAULTFRAMESPERBUFFER;
+int global_antidenormal = 0; //0 for none, 1 to add a tiny dc, 2 a tiny noise, into the master delay's feedback path (for code that does not run with FTZ/DAZ)
+SpiAudioBackend* global_paudiobackend = NULL;
+
 // Forward declarations of functions included in this code module:
 ATOM				MyRegisterClass(HINSTANCE hInstance);
 BOOL				InitInstance(HINSTANCE, int);
@@ -291,7 +390,7 @@ typedef unsigned char SAMPLE;
 std::map<string, int> global_inputdevicemap;
 std::map<string, int> global_outputdevicemap;
 
-PaStream* global_stream;
+//PaStream* global_stream; //owned by SpiPortAudioBackend now
 PaStreamParameters global_inputParameters;
 PaStreamParameters global_outputParameters;
 PaError global_err;
@@ -311,31 +410,201 @@ FILE* pFILE2 = NULL;
 
 bool global_abort = false;
 
-static int renderCallback(const void *inputBuffer, void *outputBuffer,
+static int renderCallback(float* outputBuffer,
 	unsigned long framesPerBuffer,
-	const PaStreamCallbackTimeInfo* timeInfo,
-	PaStreamCallbackFlags statusFlags,
+	unsigned int statusFlags,
 	void *userData);
 
 static int gNumNoInputs = 0;
-// This routine will be called by the PortAudio engine when audio is needed.
+
+//called on the audio thread only, after the governor changed the polyphony limit
+void applyVoiceLimit(int voicelimit)
+{
+	if (global_pvoicepool)
+	{
+		global_pvoicepool->setVoiceLimit(voicelimit);
+		return;
+	}
+	for (int i = 0; i < global_numberofsamplermodules; i++)
+	{
+		poly[i].setVoiceLimit(voicelimit);
+	}
+}
+
+//called on the audio thread only, between two synthesis blocks
+void applyMidiEvent(const SpiMidiEvent& event, int frameoffset)
+{
+	if (event.type == SPIMIDIEVENT_NOTEON)
+	{
+		global_notecache.request(event.module, event.note); //an evicted note starts on its resident head while it is reloaded
+	}
+	if (global_pvoicepool)
+	{
+		if (event.type == SPIMIDIEVENT_NOTEON)
+			global_pvoicepool->noteOn(event.module, event.note, event.velocity, frameoffset);
+		else
+			global_pvoicepool->noteOff(event.module, event.note, frameoffset);
+	}
+	else if (event.type == SPIMIDIEVENT_NOTEON)
+	{
+		poly[event.module].noteOn(event.module, event.note, event.velocity, frameoffset);
+	}
+	else
+	{
+		//poly[event.module].noteOff(event.note, frameoffset);
+		poly[event.module].noteOff(event.module, event.note, frameoffset);
+	}
+}
+
+//source of note events for renderWithEvents(), peek() gives the next event and its frame
+//relative to the start of the buffer being rendered
+class MidiEventSource
+{
+public:
+	virtual bool peek(SpiMidiEvent& event, long& eventframe) = 0;
+	virtual void pop() = 0;
+};
+
+//live events posted by receive_poll(). the buffer is mapped onto the porttime window that
+//ended at the start of the callback, delayed by one synthesis block so that no event falls
+//into a block tonic already computed.
+class QueuedMidiEventSource : public MidiEventSource
+{
+public:
+	QueuedMidiEventSource(unsigned long framesPerBuffer)
+	{
+		framesperms = global_samplerate / 1000.0;
+		windowstart_ms = Pt_Time() - framesPerBuffer / framesperms;
+	}
+	bool peek(SpiMidiEvent& event, long& eventframe)
+	{
+		if (!global_midieventqueue.peek(event)) return false;
+		eventframe = kSynthesisBlockSize + (long)((event.timestamp - windowstart_ms) * framesperms);
+		return true;
+	}
+	void pop() { global_midieventqueue.pop(); }
+private:
+	double framesperms;
+	double windowstart_ms;
+};
+
+//events of a standard midi file at their exact frame, for the offline render
+class OfflineMidiEventSource : public MidiEventSource
+{
+public:
+	OfflineMidiEventSource() : next(0), bufferstartframe(0) {}
+	void add(const SpiMidiEvent& event, long frame) { events.push_back(event); frames.push_back(frame); }
+	long getLastFrame() { return frames.empty() ? 0 : frames.back(); }
+	unsigned int getNumberOfEvents() { return events.size(); } //note ons and offs queued for the render
+	void setBufferStartFrame(long frame) { bufferstartframe = frame; }
+	bool peek(SpiMidiEvent& event, long& eventframe)
+	{
+		if (next >= events.size()) return false;
+		event = events[next];
+		eventframe = frames[next] - bufferstartframe;
+		return true;
+	}
+	void pop() { next++; }
+private:
+	vector<SpiMidiEvent> events;
+	vector<long> frames;
+	unsigned int next;
+	long bufferstartframe;
+};
+
+//called on the audio thread only, between two synthesis blocks. the idle buffer players
+//still holding a table of a replaced keymap are moved onto the current keymap so that
+//the old one can be released, the playing ones move at their next note on
+void moveIdleSynthPlayers()
+{
+	bool replacing = false;
+	for (int m = 0; m < global_numberofsamplermodules; m++)
+	{
+		if (global_keymapslot[m].isReplacing()) replacing = true;
+	}
+	if (!replacing) return;
+	if (global_ppoolsuperplayer)
+	{
+		for (int v = 0; v < global_voicepoolsize; v++)
+		{
+			if (global_ppoolsuperplayer[v].isOnReplacedKeymap() && global_pvoicepool->isVoiceIdle(v))
+				global_ppoolsuperplayer[v].setBuffer(0);
+		}
+		return;
+	}
+	for (int m = 0; m < global_numberofsamplermodules; m++)
+	{
+		if (!global_keymapslot[m].isReplacing() || global_psuperplayer[m] == NULL) continue;
+		for (int v = 0; v < SPITMIPS_NUMBEROFVOICES; v++)
+		{
+			if (global_psuperplayer[m][v].isOnReplacedKeymap() && poly[m].isVoiceIdle(v))
+				global_psuperplayer[m][v].setBuffer(0);
+		}
+	}
+}
+
+//renders numberofframes frames in pieces that end on tonic's synthesis block boundaries.
+//tonic renders kSynthesisBlockSize frames at a time, events are applied just before the block
+//they fall into and the native sampler starts or releases the voice at the exact frame.
+void renderWithEvents(float* outframes, unsigned long numberofframes, MidiEventSource& source)
+{
+	unsigned long frame = 0;
+	while (frame < numberofframes)
+	{
+		if (global_renderedframes % kSynthesisBlockSize == 0)
+		{
+			//the next fill computes a new synthesis block
+			for (int m = 0; m < global_numberofsamplermodules; m++)
+			{
+				global_keymapslot[m].update(); //a replaced keymap takes effect for all the module's voices at once
+			}
+			moveIdleSynthPlayers();
+			SpiMidiEvent event;
+			long eventframe;
+			while (source.peek(event, eventframe))
+			{
+				if (eventframe >= (long)(frame + kSynthesisBlockSize)) break; //for a later block
+				int frameoffset = (eventframe > (long)frame) ? (int)(eventframe - frame) : 0; //late events at block start
+				applyMidiEvent(event, frameoffset);
+				source.pop();
+			}
+		}
+		unsigned long count = kSynthesisBlockSize - global_renderedframes % kSynthesisBlockSize;
+		if (count > numberofframes - frame) count = numberofframes - frame;
+		synth.fillBufferOfFloats(outframes + frame * NUM_CHANNELS, count, NUM_CHANNELS);
+		frame += count;
+		global_renderedframes += count;
+	}
+}
+
+//called on the midi thread, the event is applied by the audio thread
+void postMidiEvent(PmTimestamp timestamp, int type, int module, int note, int velocity)
+{
+	SpiMidiEvent event;
+	event.timestamp = timestamp;
+	event.type = (unsigned char)type;
+	event.module = (unsigned char)module;
+	event.note = (unsigned char)note;
+	event.velocity = (unsigned char)velocity;
+	global_midieventqueue.push(event);
+}
+// This routine will be called by the audio backend when audio is needed.
 // It may be called at interrupt level on some machines so don't do anything
 // that could mess up the system like calling malloc() or free().
 //
-static int renderCallback(const void *inputBuffer, void *outputBuffer,
+static int renderCallback(float* outputBuffer,
 	unsigned long framesPerBuffer,
-	const PaStreamCallbackTimeInfo* timeInfo,
-	PaStreamCallbackFlags statusFlags,
+	unsigned int statusFlags,
 	void *userData)
 {
+	SPIRTCHECK_SCOPE(); //no allocation, lock or file i/o from here on in debug builds
+	SpiDenormal_DisableOnThisThread(); //flush the decaying delay and filter tails to zero
+	global_loadmeter.beginBlock();
 	SAMPLE *out = (SAMPLE*)outputBuffer;
-	const SAMPLE *in = (const SAMPLE*)inputBuffer;
 	unsigned int i;
-	(void)timeInfo; // Prevent unused variable warnings.
-	(void)statusFlags;
-	(void)userData;
+	(void)userData; // Prevent unused variable warnings.
 
-	if (global_abort == true) return paAbort;
+	if (global_abort == true) return SPIAUDIO_ABORT;
 
 	/*
 	if( inputBuffer == NULL )
@@ -359,9 +628,114 @@ static int renderCallback(const void *inputBuffer, void *outputBuffer,
 
 
 	//synth.fillBufferOfFloats((float*)outputBuffer, nBufferFrames, NUM_CHANNELS);
-	synth.fillBufferOfFloats((float*)outputBuffer, framesPerBuffer, NUM_CHANNELS);
+	//synth.fillBufferOfFloats((float*)outputBuffer, framesPerBuffer, NUM_CHANNELS);
+
+	//////////////////////////////////////////////////////////////
+	//render in pieces, applying queued midi events at their frame
+	//////////////////////////////////////////////////////////////
+	QueuedMidiEventSource source(framesPerBuffer);
+	renderWithEvents(outputBuffer, framesPerBuffer, source);
 
-	return paContinue;
+	global_loadmeter.endBlock(framesPerBuffer, global_samplerate,
+		(statusFlags & SPIAUDIO_OUTPUTUNDERFLOW) != 0,
+		(statusFlags & SPIAUDIO_XRUN) != 0);
+	if (global_polyphonygovernor.update(global_loadmeter.getBlockLoad(), global_loadmeter.getLoad(), framesPerBuffer, global_samplerate))
+	{
+		applyVoiceLimit(global_polyphonygovernor.getVoiceLimit()); //takes effect from the next block
+	}
+	return SPIAUDIO_CONTINUE;
+}
+
+
+//renders a standard midi file into a wav file as fast as possible, channels are mapped
+//to the sampler modules the same way receive_poll() does. returns the process exit code.
+int RenderMidiFileOffline(const string& midifilename, const string& wavfilename)
+{
+	SpiDenormal_DisableOnThisThread(); //same floating point mode as the audio thread
+	vector<SpiSmfEvent> smfevents;
+	if (!SpiSmf_Load(midifilename.c_str(), smfevents))
+	{
+		if (pFILE2) fprintf(pFILE2, "offline render, unable to read midi file %s\n", midifilename.c_str());
+		return 1;
+	}
+	OfflineMidiEventSource source;
+	vector<SpiMidiEvent> noteons; //for the note cache, loaded before the buffer they fall into
+	vector<long> noteonframes;
+	for (unsigned int i = 0; i < smfevents.size(); i++)
+	{
+		int command = smfevents[i].status & MIDI_CODE_MASK;
+		int chan = smfevents[i].status & MIDI_CHN_MASK;
+		int module = -1;
+		if ((global_inputmidichannel != -1) && (chan == global_inputmidichannel)) module = 0;
+		else if ((global_inputmidichannel == -1) && (chan < global_numberofsamplermodules)) module = chan;
+		if (module < 0) continue;
+
+		SpiMidiEvent event;
+		event.timestamp = (long)(smfevents[i].time_s * 1000.0);
+		event.module = (unsigned char)module;
+		event.note = smfevents[i].data1;
+		event.velocity = smfevents[i].data2;
+		if (command == MIDI_OFF_NOTE || (command == MIDI_ON_NOTE && event.velocity == 0)) event.type = SPIMIDIEVENT_NOTEOFF;
+		else if (command == MIDI_ON_NOTE) event.type = SPIMIDIEVENT_NOTEON;
+		else continue;
+		source.add(event, (long)(smfevents[i].time_s * global_samplerate + 0.5));
+		if (event.type == SPIMIDIEVENT_NOTEON)
+		{
+			noteons.push_back(event);
+			noteonframes.push_back((long)(smfevents[i].time_s * global_samplerate + 0.5));
+		}
+	}
+
+	SndfileHandle file(wavfilename, SFM_WRITE, SF_FORMAT_WAV | SF_FORMAT_FLOAT, NUM_CHANNELS, global_samplerate);
+	if (file.error())
+	{
+		if (pFILE2) fprintf(pFILE2, "offline render, unable to create wav file %s\n", wavfilename.c_str());
+		return 1;
+	}
+
+	long numberofframes = source.getLastFrame() + (long)(SPITMIPS_OFFLINETAIL_S * global_samplerate);
+	vector<float> buffer(global_framesperbuffer * NUM_CHANNELS);
+	LARGE_INTEGER frequency, start, stop;
+	QueryPerformanceFrequency(&frequency);
+	LONGLONG render_ticks = 0;
+	unsigned int nextnoteon = 0;
+	for (long frame = 0; frame < numberofframes; frame += global_framesperbuffer)
+	{
+		unsigned long count = (numberofframes - frame < global_framesperbuffer) ? (unsigned long)(numberofframes - frame) : global_framesperbuffer;
+		source.setBufferStartFrame(frame);
+		if (global_notecache.isEnabled())
+		{
+			//no worker offline, evicted notes are reloaded before their buffer and the budget kept after it
+			for (; nextnoteon < noteons.size() && noteonframes[nextnoteon] < frame + (long)count; nextnoteon++)
+			{
+				global_notecache.load(noteons[nextnoteon].module, noteons[nextnoteon].note);
+			}
+			global_notecache.trim();
+		}
+		QueryPerformanceCounter(&start);
+		{
+			SPIRTCHECK_SCOPE(); //same rules as the audio callback
+			renderWithEvents(&buffer[0], count, source);
+		}
+		QueryPerformanceCounter(&stop);
+		render_ticks += stop.QuadPart - start.QuadPart;
+		file.writef(&buffer[0], count);
+	}
+
+	double audio_s = (double)numberofframes / global_samplerate;
+	double render_s = (double)render_ticks / (double)frequency.QuadPart;
+	if (pFILE2)
+	{
+		fprintf(pFILE2, "offline render of %s into %s\n", midifilename.c_str(), wavfilename.c_str());
+		fprintf(pFILE2, "%d note events, %.3f s of audio rendered in %.3f s, real-time factor %.1fx\n",
+			(int)source.getNumberOfEvents(), audio_s, render_s, (render_s > 0.0) ? audio_s / render_s : 0.0);
+		fflush(pFILE2);
+	}
+#if SPIRTCHECK_ENABLED
+	SpiRtCheck_Report(pFILE2);
+	if (SpiRtCheck_GetTotalNumberOfViolations() > 0) return 2;
+#endif
+	return 0;
 }
 
 
@@ -483,6 +857,11 @@ bool SelectAudioOutputDevice()
 	global_outputParameters.sampleFormat = PA_SAMPLE_TYPE;
 	global_outputParameters.suggestedLatency = Pa_GetDeviceInfo(global_outputParameters.device)->defaultLowOutputLatency;
 	//outputParameters.hostApiSpecificStreamInfo = NULL;
+	if (global_samplerate <= 0)
+	{
+		//run at the interface's native rate, no resampling in the host api
+		global_samplerate = (int)(Pa_GetDeviceInfo(global_outputParameters.device)->defaultSampleRate + 0.5);
+	}
 
 	//Use an ASIO specific structure. WARNING - this is not portable. 
 	//PaAsioStreamInfo asioInputInfo;
@@ -508,6 +887,10 @@ bool SelectAudioOutputDevice()
 		//assert(false);
 		global_outputParameters.hostApiSpecificStreamInfo = NULL;
 	}
+	if (Pa_IsFormatSupported(NULL, &global_outputParameters, global_samplerate) != paFormatIsSupported)
+	{
+		if (pFILE) fprintf(pFILE, "warning, sample rate %d not supported by output device id=%d, the stream may fail to open\n", global_samplerate, deviceid);
+	}
 	return true;
 }
 
@@ -529,20 +912,23 @@ void receive_poll(PtTimestamp timestamp, void *userData)
 			if ( (global_inputmidichannel!=-1) && (chan == global_inputmidichannel) )
 			{
 				//1) output message
-				mySpiMidiUtility.output(event.message);
+				//mySpiMidiUtility.output(event.message);
+				global_logring.logMidiMessage(event.message, event.timestamp);
 
 				//2) 
 				if (command == MIDI_OFF_NOTE || (command == MIDI_ON_NOTE && data2==0))
 				{
 					int midinotenumber = data1; //range 0 to 127
 					int midinotevelocity = data2; //range 0 to 127
-					poly[0].noteOff(midinotenumber);
+					//poly[0].noteOff(midinotenumber);
+					postMidiEvent(event.timestamp, SPIMIDIEVENT_NOTEOFF, 0, midinotenumber, midinotevelocity);
 				}
 				else if (command == MIDI_ON_NOTE)
 				{
 					int midinotenumber = data1; //range 0 to 127
 					int midinotevelocity = data2; //range 0 to 127
-					poly[0].noteOn(0, midinotenumber, midinotevelocity);
+					//poly[0].noteOn(0, midinotenumber, midinotevelocity);
+					postMidiEvent(event.timestamp, SPIMIDIEVENT_NOTEON, 0, midinotenumber, midinotevelocity);
 				}
 				else if (command == MIDI_CH_PROGRAM)
 				{
@@ -562,20 +948,23 @@ void receive_poll(PtTimestamp timestamp, void *userData)
 			else if ( (global_inputmidichannel == -1) && (chan < global_numberofsamplermodules) )
 			{
 				//1) output message
-				mySpiMidiUtility.output(event.message);
+				//mySpiMidiUtility.output(event.message);
+				global_logring.logMidiMessage(event.message, event.timestamp);
 
 				//2) 
 				if (command == MIDI_OFF_NOTE || (command == MIDI_ON_NOTE && data2 == 0))
 				{
 					int midinotenumber = data1; //range 0 to 127
 					int midinotevelocity = data2; //range 0 to 127
-					poly[chan].noteOff(midinotenumber);
+					//poly[chan].noteOff(midinotenumber);
+					postMidiEvent(event.timestamp, SPIMIDIEVENT_NOTEOFF, chan, midinotenumber, midinotevelocity);
 				}
 				else if (command == MIDI_ON_NOTE)
 				{
 					int midinotenumber = data1; //range 0 to 127
 					int midinotevelocity = data2; //range 0 to 127
-					poly[chan].noteOn(chan, midinotenumber, midinotevelocity);
+					//poly[chan].noteOn(chan, midinotenumber, midinotevelocity);
+					postMidiEvent(event.timestamp, SPIMIDIEVENT_NOTEON, chan, midinotenumber, midinotevelocity);
 				}
 				else if (command == MIDI_CH_PROGRAM)
 				{
@@ -603,6 +992,39 @@ void receive_poll(PtTimestamp timestamp, void *userData)
     }
 }
 
+//called on the ui thread by WM_TIMER, formats and displays what the real-time threads logged
+void DrainLogRing()
+{
+	char text[1024];
+	int displayed = 0;
+	int skipped = 0;
+	SpiLogRecord record;
+	while (global_logring.pop(record))
+	{
+		if (record.type == SPILOG_MIDIMESSAGE)
+		{
+			if (displayed < SPITMIPS_LOGMAXMESSAGESPERTICK)
+			{
+				mySpiMidiUtility.output(record.message);
+				displayed++;
+			}
+			else
+			{
+				skipped++;
+			}
+		}
+		else
+		{
+			sprintf(text, ">> %s note %d on voice %d, module %d\n", (record.type == SPILOG_NOTESTART) ? "Starting" : "Stopping", record.note, record.voice, record.module);
+			OutputDebugStringA(text);
+		}
+	}
+	if (skipped > 0)
+	{
+		sprintf(text, "(%d midi messages not displayed)\n", skipped);StatusAddTextA(text);
+	}
+}
+
 void CALLBACK StartGlobalProcess(UINT uTimerID, UINT uMsg, DWORD dwUser, DWORD dw1, DWORD dw2)
 {
 	//WavSetLib_Initialize(global_hwnd, IDC_MAIN_STATIC, global_staticwidth, global_staticheight, global_fontwidth, global_fontheight);
@@ -732,6 +1154,34 @@ void CALLBACK StartGlobalProcess(UINT uTimerID, UINT uMsg, DWORD dwUser, DWORD d
 }
 
 
+//stereo note table at the engine sample rate. mono samples are duplicated on both
+//channels, samples recorded at another rate are converted once here rather than
+//shifting their pitch or resampling on the audio thread.
+SampleTable* createNoteTable(const float* data, long frames, int channels, int samplerate)
+{
+	vector<float> stereo;
+	if (channels == 1)
+	{
+		stereo.resize(frames * 2);
+		for (long i = 0; i < frames; i++)
+		{
+			stereo[2 * i] = data[i];
+			stereo[2 * i + 1] = data[i];
+		}
+		data = &stereo[0];
+	}
+	if (samplerate == global_samplerate)
+	{
+		SampleTable* table = new SampleTable(frames, 2);
+		memcpy(table->dataPointer(), data, frames * 2 * sizeof(float));
+		return table;
+	}
+	long outputframes = SpiResample_GetNumberOfFrames(frames, samplerate, global_samplerate);
+	SampleTable* table = new SampleTable(outputframes, 2);
+	SpiResample(data, frames, 2, samplerate, table->dataPointer(), outputframes, global_samplerate);
+	return table;
+}
+
 //WavSet myWavSet;
 void pitchshift(int midinote, int referencemidinote)
 {
@@ -740,7 +1190,7 @@ void pitchshift(int midinote, int referencemidinote)
 	///////////////////////////////////////
 	//create wavset from tonic sample table
 	///////////////////////////////////////
-	WavSet myWavSet(44100, 
+	WavSet myWavSet(global_samplerate, 
 		global_ppbuffer[global_samplermodulesindex][referencemidinote]->channels(),
 		global_ppbuffer[global_samplermodulesindex][referencemidinote]->frames(),
 		(float*)(global_ppbuffer[global_samplermodulesindex][referencemidinote]->dataPointer()));
@@ -778,8 +1228,9 @@ void pitchshift(int midinote, int referencemidinote)
 	//semitones = 3;	// shift up by 3 semitones
 	//semitones = -3; // shift down by 3 semitones
 	float pitchShift = pow(2., semitones / 12.);	// convert semitones to factor
-	smbPitchShift(pitchShift, myLeftWavSet.numSamples, 2048, 4, 44100.0, myLeftWavSet.pSamples, myLeftWavSet.pSamples);
-	smbPitchShift(pitchShift, myRightWavSet.numSamples, 2048, 4, 44100.0, myRightWavSet.pSamples, myRightWavSet.pSamples);
+	long fftframesize = (global_samplerate > 48000) ? 4096 : 2048; //same frequency resolution at 88.2 and 96 kHz
+	smbPitchShift(pitchShift, myLeftWavSet.numSamples, fftframesize, 4, (float)global_samplerate, myLeftWavSet.pSamples, myLeftWavSet.pSamples);
+	smbPitchShift(pitchShift, myRightWavSet.numSamples, fftframesize, 4, (float)global_samplerate, myRightWavSet.pSamples, myRightWavSet.pSamples);
 
 	//recombine left and right channels
 	WavSet myPitchShiftedWavSet;
@@ -825,6 +1276,243 @@ bool hasmidinotegaps()
 	return bgapfound;
 }
 
+//peak, rms, dc offset and onset of every supplied sample, analyzed in parallel. the
+//silence found ahead of the onset and after the tail is cut off the note table.
+void trimSynthSamples()
+{
+	vector<int>& midinotes = global_suppliedmidinotes[global_samplermodulesindex][0];
+	int count = (int)midinotes.size();
+	if (count == 0) return;
+	vector<const float*> data(count);
+	vector<long> frames(count);
+	vector<SpiSampleAnalysis> analyses(count);
+	for (int i = 0; i < count; i++)
+	{
+		SampleTable* table = global_ppbuffer[global_samplermodulesindex][midinotes[i]];
+		data[i] = table->dataPointer();
+		frames[i] = (long)table->frames();
+	}
+	SpiSampleAnalysis_AnalyzeAll(&data[0], &frames[0], count, global_samplerate,
+		global_leadingsilence_db, global_trailingsilence_db, &analyses[0]);
+
+	long trimmedframes = 0;
+	for (int i = 0; i < count; i++)
+	{
+		int midinote = midinotes[i];
+		SpiSampleAnalysis& analysis = analyses[i];
+		global_sampleanalysis[global_samplermodulesindex][midinote] = analysis;
+		long keptframes = analysis.lastframe - analysis.firstframe;
+		if (keptframes > 0 && keptframes < analysis.frames)
+		{
+			SampleTable* table = global_ppbuffer[global_samplermodulesindex][midinote];
+			SampleTable* trimmedtable = new SampleTable(keptframes, 2);
+			memcpy(trimmedtable->dataPointer(), table->dataPointer() + 2 * analysis.firstframe, keptframes * 2 * sizeof(float));
+			if (analysis.lastframe < analysis.frames)
+			{
+				SpiSampleAnalysis_FadeOut(trimmedtable->dataPointer(), keptframes, (long)(SPISAMPLEANALYSIS_FADEOUT_S * global_samplerate));
+			}
+			delete table;
+			global_ppbuffer[global_samplermodulesindex][midinote] = trimmedtable;
+			global_sampleduration_s[global_samplermodulesindex][midinote] = ((float)keptframes) / ((float)global_samplerate);
+			trimmedframes += analysis.frames - keptframes;
+		}
+		if (pFILE2)
+		{
+			fprintf(pFILE2, "midinote %d: peak %.1f dB, rms %.1f dB, dc %.5f %.5f, onset at %.1f ms, %.1f ms trimmed ahead, %.1f ms trimmed after\n",
+				midinote, 20.0 * log10(analysis.peak + 1e-9), 20.0 * log10(analysis.rms + 1e-9),
+				analysis.dcoffset[0], analysis.dcoffset[1],
+				analysis.onsetframe * 1000.0 / global_samplerate,
+				analysis.firstframe * 1000.0 / global_samplerate,
+				(analysis.frames - analysis.lastframe) * 1000.0 / global_samplerate);
+		}
+	}
+	if (pFILE2)
+	{
+		fprintf(pFILE2, "%.1f MB of silence trimmed from %d samples\n", trimmedframes * 2.0 * sizeof(float) / (1024.0 * 1024.0), count);
+		fflush(pFILE2);
+	}
+}
+
+//sustain loop of every note table, searched in parallel. a looped note table is cut
+//after its loop end plus SPISAMPLEANALYSIS_LOOPRELEASE_S, the native sampler loops it
+//for as long as the note is held.
+void loopSynthSamples()
+{
+	vector<const float*> data(SPITMIPS_NSAMPLES);
+	vector<long> frames(SPITMIPS_NSAMPLES);
+	vector<SpiSampleLoop> loops(SPITMIPS_NSAMPLES);
+	for (int midinote = 0; midinote < SPITMIPS_NSAMPLES; midinote++)
+	{
+		SampleTable* table = global_ppbuffer[global_samplermodulesindex][midinote];
+		data[midinote] = table->dataPointer();
+		frames[midinote] = (long)table->frames();
+		global_noteloopstart[global_samplermodulesindex][midinote] = 0;
+		global_noteloopend[global_samplermodulesindex][midinote] = 0;
+	}
+	SpiSampleAnalysis_FindLoopsAll(&data[0], &frames[0], SPITMIPS_NSAMPLES, global_samplerate, &loops[0]);
+
+	long savedframes = 0;
+	int numberofloops = 0;
+	for (int midinote = 0; midinote < SPITMIPS_NSAMPLES; midinote++)
+	{
+		SpiSampleLoop& loop = loops[midinote];
+		if (loop.loopend == 0) continue;
+		SampleTable* table = global_ppbuffer[global_samplermodulesindex][midinote];
+		SpiSampleAnalysis_CrossfadeLoop(table->dataPointer(), loop, global_samplerate);
+		long keptframes = loop.loopend + (long)(SPISAMPLEANALYSIS_LOOPRELEASE_S * global_samplerate);
+		if (keptframes < frames[midinote])
+		{
+			SampleTable* loopedtable = new SampleTable(keptframes, 2);
+			memcpy(loopedtable->dataPointer(), table->dataPointer(), keptframes * 2 * sizeof(float));
+			SpiSampleAnalysis_FadeOut(loopedtable->dataPointer(), keptframes, (long)(SPISAMPLEANALYSIS_FADEOUT_S * global_samplerate));
+			delete table;
+			global_ppbuffer[global_samplermodulesindex][midinote] = loopedtable;
+			savedframes += frames[midinote] - keptframes;
+		}
+		global_noteloopstart[global_samplermodulesindex][midinote] = (unsigned int)loop.loopstart;
+		global_noteloopend[global_samplermodulesindex][midinote] = (unsigned int)loop.loopend;
+		numberofloops++;
+		if (pFILE2)
+		{
+			fprintf(pFILE2, "midinote %d: sustain loop %.3f s to %.3f s, correlation %.3f\n", midinote,
+				loop.loopstart / (double)global_samplerate, loop.loopend / (double)global_samplerate, loop.correlation);
+		}
+	}
+	if (pFILE2)
+	{
+		fprintf(pFILE2, "%d notes looped, %.1f MB saved\n", numberofloops, savedframes * 2.0 * sizeof(float) / (1024.0 * 1024.0));
+		fflush(pFILE2);
+	}
+}
+
+//true for a note filled by pitchshift() rather than supplied
+bool isPitchShiftedNote(int midinote)
+{
+	for (int stage = 0; stage < SPITMIPS_MAXNUMSTAGE; stage++)
+	{
+		vector<int>& notes = global_pitchshiftedmidinotes[global_samplermodulesindex][stage];
+		if (find(notes.begin(), notes.end(), midinote) != notes.end()) return true;
+	}
+	return false;
+}
+
+//moves the finished note tables of the module into its note arena, sized from their
+//final lengths, and frees the tables. the native sampler plays from the arena. with a
+//note cache, the pitch shifted notes go to the cache instead and only the supplied
+//ones (and the silence fill) are kept in the arena.
+void packSynthSamples()
+{
+	unsigned int frames[SPITMIPS_NSAMPLES];
+	bool cached[SPITMIPS_NSAMPLES];
+	for (int midinote = 0; midinote < SPITMIPS_NSAMPLES; midinote++)
+	{
+		cached[midinote] = global_notecache.isEnabled() && isPitchShiftedNote(midinote);
+		frames[midinote] = cached[midinote] ? 0 : global_ppbuffer[global_samplermodulesindex][midinote]->frames();
+	}
+	if (!global_notearena[global_samplermodulesindex].allocate(frames, SPITMIPS_NSAMPLES, 2, global_samplememory >= 3))
+	{
+		if (pFILE2)
+		{
+			fprintf(pFILE2, "warning, no memory for the note arena, note tables kept as loaded\n");
+			fflush(pFILE2);
+		}
+		return;
+	}
+	int numberofcachednotes = 0;
+	for (int midinote = 0; midinote < SPITMIPS_NSAMPLES; midinote++)
+	{
+		SampleTable* ptable = global_ppbuffer[global_samplermodulesindex][midinote];
+		if (!cached[midinote])
+			memcpy(global_notearena[global_samplermodulesindex].getNoteData(midinote), ptable->dataPointer(), frames[midinote] * 2 * sizeof(float));
+		else if (global_notecache.addNote(global_samplermodulesindex, midinote, ptable->dataPointer(), ptable->frames()))
+			numberofcachednotes++;
+		else if (pFILE2)
+			fprintf(pFILE2, "warning, no memory for pitch shifted midinote %d, note dropped\n", midinote);
+		delete global_ppbuffer[global_samplermodulesindex][midinote];
+		global_ppbuffer[global_samplermodulesindex][midinote] = NULL;
+	}
+	if (pFILE2)
+	{
+		fprintf(pFILE2, "note arena of %.1f MB%s\n", global_notearena[global_samplermodulesindex].getSize() / (1024.0 * 1024.0),
+			global_notearena[global_samplermodulesindex].isLargePages() ? " in large pages" : "");
+		fflush(pFILE2);
+	}
+	if (global_notecache.isEnabled())
+	{
+		global_notecache.trim(); //keeps the load within the budget too
+		if (pFILE2)
+		{
+			fprintf(pFILE2, "%d pitch shifted notes in the note cache, %.1f MB resident plus %.1f MB of heads for all modules, %d evicted so far\n",
+				numberofcachednotes, global_notecache.getResidentBytes() / (1024.0 * 1024.0), global_notecache.getHeadBytes() / (1024.0 * 1024.0), (int)global_notecache.getNumberOfEvictions());
+			fflush(pFILE2);
+		}
+	}
+}
+
+//touches every page of the module's note data so that the first play of a note does not
+//page fault on the audio thread, and with global_samplememory 2 or more locks the pages
+//so that they stay resident
+void lockSynthSamples()
+{
+	if (global_samplememory <= 0) return;
+	size_t prefaulted = 0;
+	size_t locked = 0;
+	SpiNoteArena& notearena = global_notearena[global_samplermodulesindex];
+	if (notearena.getSize() > 0)
+	{
+		prefaulted += notearena.prefault();
+		if (global_samplememory >= 2 && notearena.lock()) locked += notearena.getSize();
+	}
+	else
+	{
+		for (int midinote = 0; midinote < SPITMIPS_NSAMPLES; midinote++)
+		{
+			SampleTable* ptable = global_ppbuffer[global_samplermodulesindex][midinote];
+			if (ptable == NULL) continue;
+			size_t bytes = ptable->frames() * ptable->channels() * sizeof(TonicFloat);
+			prefaulted += SpiMemoryLock_Prefault(ptable->dataPointer(), bytes);
+			//the tables are locked for the life of the process, unloadSynthSamples() only runs at exit
+			if (global_samplememory >= 2 && SpiMemoryLock_Lock(ptable->dataPointer(), bytes)) locked += bytes;
+		}
+	}
+	global_samplememoryprefaulted += prefaulted;
+	global_samplememorylocked += locked;
+	if (pFILE2)
+	{
+		fprintf(pFILE2, "sample memory, %.1f MB prefaulted, %.1f MB locked\n", prefaulted / (1024.0 * 1024.0), locked / (1024.0 * 1024.0));
+		if (global_samplememory >= 2 && locked < prefaulted)
+		{
+			fprintf(pFILE2, "warning, sample memory could not all be locked, pages may fault on first play\n");
+		}
+		fflush(pFILE2);
+	}
+}
+
+//note data of a module for the native sampler, from its arena or its tables if the arena could not be allocated
+void setSamplerNoteBank(PolySampler& sampler, int bank, int module)
+{
+	if (global_notearena[module].getSize() > 0)
+	{
+		//the cached notes from the note cache, NULL while evicted
+		const TonicFloat* data[SPITMIPS_NSAMPLES];
+		unsigned int frames[SPITMIPS_NSAMPLES];
+		for (int midinote = 0; midinote < SPITMIPS_NSAMPLES; midinote++)
+		{
+			bool cached = global_notecache.isCached(module, midinote);
+			data[midinote] = cached ? global_notecache.getNoteData(module, midinote) : global_notearena[module].getNoteData(midinote);
+			frames[midinote] = cached ? global_notecache.getNoteFrames(module, midinote) : global_notearena[module].getNoteFramesArray()[midinote];
+		}
+		sampler.setNoteBank(bank, data, frames);
+		for (int midinote = 0; midinote < SPITMIPS_NSAMPLES; midinote++)
+		{
+			sampler.setNoteHead(bank, midinote, global_notecache.getNoteHead(module, midinote), global_notecache.getNoteHeadFrames(module, midinote));
+		}
+	}
+	else
+		sampler.setNoteBank(bank, global_ppbuffer[module]);
+	sampler.setNoteLoops(bank, global_noteloopstart[module], global_noteloopend[module]);
+}
+
 void loadSynthSamples(string samplesfolder, string samplesfilter)
 {
 	//global_samplermodulesindex
@@ -866,32 +1554,28 @@ void loadSynthSamples(string samplesfolder, string samplesfilter)
 	{
 		WavSet myWavSet;
 		myWavSet.ReadWavFile(global_samplefilenames[i].c_str());
-		if (myWavSet.SampleRate == 48000)
+		if (myWavSet.SampleRate <= 0)
 		{
-			myWavSet.SampleRate = 44100; //it will shift the frequency, but hey!
 			if (pFILE2)
 			{
-				fprintf(pFILE2, "warning, samplerate forced to 44100, samplerate was 48000 for sample name %s\n", global_samplefilenames[i].c_str());
+				fprintf(pFILE2, "error, samplerate is %d for sample name %s\n", myWavSet.SampleRate, global_samplefilenames[i].c_str());
+				fclose(pFILE2);
 			}
+			exit(1);
 		}
-		if (myWavSet.SampleRate != 44100)
+		if (myWavSet.SampleRate != global_samplerate)
 		{
+			//myWavSet.SampleRate = 44100; //it will shift the frequency, but hey!
 			if (pFILE2)
 			{
-				fprintf(pFILE2, "error, samplerate different than 44100, samplerate is %d for sample name %s\n", myWavSet.SampleRate, global_samplefilenames[i].c_str());
-				fclose(pFILE2);
+				fprintf(pFILE2, "warning, samplerate converted from %d to %d for sample name %s\n", myWavSet.SampleRate, global_samplerate, global_samplefilenames[i].c_str());
 			}
-			exit(1);
 		}
-		if (myWavSet.numChannels == 1)
-		{
-			myWavSet.Resample44100monoTo44100stereo();
-		}
-		if (myWavSet.numChannels != 2)
+		if (myWavSet.numChannels != 1 && myWavSet.numChannels != 2)
 		{
 			if (pFILE2)
 			{
-				fprintf(pFILE2, "error, channels different than 2, channels is %d for sample name %s\n", myWavSet.numChannels, global_samplefilenames[i].c_str());
+				fprintf(pFILE2, "error, channels different than 1 or 2, channels is %d for sample name %s\n", myWavSet.numChannels, global_samplefilenames[i].c_str());
 				fclose(pFILE2);
 			}
 			exit(1);
@@ -918,8 +1602,7 @@ void loadSynthSamples(string samplesfolder, string samplesfilter)
 		if (global_ppbuffer[global_samplermodulesindex][midinote] == NULL)
 		{
 			global_sampleduration_s[global_samplermodulesindex][midinote] = ((float)myWavSet.totalFrames) / ((float)myWavSet.SampleRate);
-			global_ppbuffer[global_samplermodulesindex][midinote] = new SampleTable(myWavSet.totalFrames, myWavSet.numChannels);
-			memcpy(global_ppbuffer[global_samplermodulesindex][midinote]->dataPointer(), myWavSet.pSamples, myWavSet.totalFrames*myWavSet.numChannels*sizeof(float));
+			global_ppbuffer[global_samplermodulesindex][midinote] = createNoteTable(myWavSet.pSamples, myWavSet.totalFrames, myWavSet.numChannels, myWavSet.SampleRate);
 			global_suppliedmidinotes[global_samplermodulesindex][0].push_back(midinote);
 		}
 		else
@@ -935,6 +1618,12 @@ void loadSynthSamples(string samplesfolder, string samplesfilter)
 	{
 		fflush(pFILE2);
 	}
+
+	//////////////////////////////////////////////////////////////
+	//analyze the supplied samples and trim their leading and
+	//trailing silence, before the gap fill pitch shifts them
+	//////////////////////////////////////////////////////////////
+	trimSynthSamples();
 	
 	int stage = -1;
 	while (hasmidinotegaps() == true && stage<(SPITMIPS_MAXNUMSTAGE-1))
@@ -1031,12 +1720,13 @@ void loadSynthSamples(string samplesfolder, string samplesfilter)
 		{
 			SndfileHandle file3;
 			file3 = SndfileHandle("silence-stereo_10sec.wav");
-			assert(file3.samplerate() == 44100);
+			//assert(file3.samplerate() == 44100);
 			assert(file3.channels() == 2);
 			assert(global_ppbuffer[global_samplermodulesindex][midinote] == NULL);
 			global_sampleduration_s[global_samplermodulesindex][midinote] = ((float)file3.frames()) / ((float)file3.samplerate());
-			global_ppbuffer[global_samplermodulesindex][midinote] = new SampleTable(file3.frames(), file3.channels());
-			file3.read(global_ppbuffer[global_samplermodulesindex][midinote]->dataPointer(), file3.frames()*file3.channels());
+			vector<float> silence(file3.frames()*file3.channels());
+			file3.read(&silence[0], file3.frames()*file3.channels());
+			global_ppbuffer[global_samplermodulesindex][midinote] = createNoteTable(&silence[0], (long)file3.frames(), file3.channels(), file3.samplerate());
 			if (pFILE2)
 			{
 				fprintf(pFILE2, "warning, sample silence for midinote %d\n", midinote);
@@ -1057,11 +1747,29 @@ void loadSynthSamples(string samplesfolder, string samplesfilter)
 		fflush(pFILE2);
 	}
 
+	//only the native sampler plays loop points, tonic buffer players loop whole tables
+	if (global_samplerengine == 1 && global_sustainloops == 1)
+	{
+		loopSynthSamples();
+	}
+	if (global_samplerengine == 1)
+	{
+		packSynthSamples();
+	}
+	lockSynthSamples();
+	if (global_samplerengine == 1)
+	{
+		return; //sampler voices, no buffer players
+	}
 
+	//one keymap for all of the module's voices instead of a copy of its tables per voice
+	global_keymapslot[global_samplermodulesindex].setKeymap(new SuperBufferKeymap(global_ppbuffer[global_samplermodulesindex]));
+	if (global_voicepoolsize > 0) return; //the pool voices play the note banks directly, no per module voices
 	global_psuperplayer[global_samplermodulesindex] = new SuperBufferPlayer[SPITMIPS_NUMBEROFVOICES];
 	for (int i = 0; i < SPITMIPS_NUMBEROFVOICES; i++)
 	{
-		global_psuperplayer[global_samplermodulesindex][i].setBuffers(global_ppbuffer[global_samplermodulesindex]);
+		//global_psuperplayer[global_samplermodulesindex][i].setBuffers(global_ppbuffer[global_samplermodulesindex]);
+		global_psuperplayer[global_samplermodulesindex][i].setKeymapSlot(&global_keymapslot[global_samplermodulesindex]);
 	}
 	return;
 }
@@ -1073,12 +1781,15 @@ void unloadSynthSamples()
 		delete global_ppbuffer[global_samplermodulesindex][i];
 	}
 	delete[] global_ppbuffer[global_samplermodulesindex];
+	global_notearena[global_samplermodulesindex].release();
 	//delete[] global_pplayer;
 	delete[] global_psuperplayer[global_samplermodulesindex];
+	global_keymapslot[global_samplermodulesindex].clear();
 }
 
 //int voiceindex = -1;
-Synth createSynthVoice()
+//Synth createSynthVoice()
+PolyVoiceSynth createSynthVoice()
 {
 	voiceindex[global_samplermodulesindex]++;
 	Synth newSynth;
@@ -1096,7 +1807,18 @@ Synth createSynthVoice()
 	//global_bufferplayers = ControlSwitcher().inputIndex(noteNum);
 
 	//Generator tone = global_pplayer[0].trigger(gate);
-	Generator tone = global_psuperplayer[global_samplermodulesindex][voiceindex[global_samplermodulesindex]].setBuffer(noteNum).trigger(gate);
+	//Generator tone = global_psuperplayer[global_samplermodulesindex][voiceindex[global_samplermodulesindex]].setBuffer(noteNum).trigger(gate);
+	Generator tone;
+	if (global_voicepoolsize > 0)
+	{
+		//pool voice, the allocator loads the claiming module's note into it at note on
+		global_poolvoiceindex++;
+		tone = global_ppoolsuperplayer[global_poolvoiceindex].setBuffer(&global_keymapslot[0], 0).trigger(gate);
+	}
+	else
+	{
+		tone = global_psuperplayer[global_samplermodulesindex][voiceindex[global_samplermodulesindex]].setBuffer(noteNum).trigger(gate);
+	}
 
 	//Generator tone = global_bufferplayers.inputIndex(noteNum).trigger(gate);
 
@@ -1107,7 +1829,7 @@ Synth createSynthVoice()
 		//.decay(4.0)
 		
 		.sustain(0.8)
-		.release(0.0)
+		.release(SPITMIPS_VOICERELEASE_S)
 		.doesSustain(true)
 		
 		/*
@@ -1128,7 +1850,15 @@ Synth createSynthVoice()
 
 	newSynth.setOutputGen(output);
 
-	return newSynth;
+	//return newSynth;
+	//the allocator writes the note events through these handles, no parameter name lookup per note
+	PolyVoiceSynth voiceSynth;
+	voiceSynth.synth = newSynth;
+	voiceSynth.note = noteNum;
+	voiceSynth.gate = gate;
+	voiceSynth.velocity = noteVelocity;
+	voiceSynth.voiceNumber = voiceNumber;
+	return voiceSynth;
 }
 
 
@@ -1141,6 +1871,10 @@ int APIENTRY _tWinMain(HINSTANCE hInstance,
 	UNREFERENCED_PARAMETER(hPrevInstance);
 	UNREFERENCED_PARAMETER(lpCmdLine);
 
+	//spi, begin
+	SpiRtCheck_Install(); //real-time safety checker, does nothing unless SPIRTCHECK_ENABLED
+	//spi, end
+
 	//LPWSTR *szArgList;
 	LPSTR *szArgList;
 	int nArgs;
@@ -1275,13 +2009,104 @@ int APIENTRY _tWinMain(HINSTANCE hInstance,
 	{
 		global_samplesfilter = szArgList[24];
 	}	
+	if (nArgs>25)
+	{
+		global_renderthreads = atoi(szArgList[25]);
+	}
+	if (nArgs>26)
+	{
+		global_samplerengine = atoi(szArgList[26]);
+	}
+	if (nArgs>27)
+	{
+		global_verbosemonitor = atoi(szArgList[27]);
+	}
+	global_logring.setEnabled(global_verbosemonitor != 0);
+	if (nArgs>28)
+	{
+		global_loadmeterdisplay_s = atoi(szArgList[28]);
+	}
+	if (nArgs>29)
+	{
+		global_offlinemidifile = szArgList[29];
+	}
+	if (nArgs>30)
+	{
+		global_offlinewavfile = szArgList[30];
+	}
+	bool offline = !global_offlinemidifile.empty();
+	if (nArgs>31)
+	{
+		global_audiobackend = atoi(szArgList[31]);
+	}
+	if (nArgs>32)
+	{
+		global_audiobackendfile = szArgList[32];
+	}
+	if (nArgs>33)
+	{
+		global_samplerate = atoi(szArgList[33]);
+	}
+	if (nArgs>34)
+	{
+		global_framesperbuffer = atoi(szArgList[34]);
+	}
+	if (nArgs>35)
+	{
+		global_antidenormal = atoi(szArgList[35]);
+	}
+	if (nArgs>36)
+	{
+		global_voicepoolsize = atoi(szArgList[36]);
+		if (global_voicepoolsize > SPITMIPS_MAXVOICEPOOLSIZE) global_voicepoolsize = SPITMIPS_MAXVOICEPOOLSIZE;
+	}
+	if (nArgs>37)
+	{
+		global_voicepoolminvoices = atoi(szArgList[37]);
+	}
+	if (nArgs>38)
+	{
+		global_voicepoolmaxvoices = atoi(szArgList[38]);
+	}
+	if (nArgs>39)
+	{
+		global_oneshotmodules = atoi(szArgList[39]);
+	}
+	if (nArgs>40)
+	{
+		global_polyphonygovernorload = atof(szArgList[40]);
+	}
+	if (nArgs>41)
+	{
+		global_polyphonygovernorminvoices = atoi(szArgList[41]);
+	}
+	if (nArgs>42)
+	{
+		global_leadingsilence_db = (float)atof(szArgList[42]);
+	}
+	if (nArgs>43)
+	{
+		global_trailingsilence_db = (float)atof(szArgList[43]);
+	}
+	if (nArgs>44)
+	{
+		global_sustainloops = atoi(szArgList[44]);
+	}
+	if (nArgs>45)
+	{
+		global_samplememory = atoi(szArgList[45]);
+	}
+	if (nArgs>46)
+	{
+		global_notecachebudget_mb = atoi(szArgList[46]);
+	}
 
 	LocalFree(szArgList);
 	LocalFree(szArgListW);
 
 	int nShowCmd = false;
 	//ShellExecuteA(NULL, "open", "begin.bat", "", NULL, nShowCmd);
-	ShellExecuteA(NULL, "open", global_begin.c_str(), "", NULL, nCmdShow);
+	if (!offline) ShellExecuteA(NULL, "open", global_begin.c_str(), "", NULL, nCmdShow);
 
 
 	//////////////////////////
@@ -1293,29 +2118,39 @@ int APIENTRY _tWinMain(HINSTANCE hInstance,
 	pFILE = fopen("devices.txt", "w");
 	pFILE2 = fopen("samples.txt", "w");
 
-	///////////////////////
-	//initialize port audio
-	///////////////////////
-	global_err = Pa_Initialize();
-	if (global_err != paNoError)
+	if (!offline && global_audiobackend == 0)
 	{
-		//MessageBox(0,"portaudio initialization failed",0,MB_ICONERROR);
-		if (pFILE) fprintf(pFILE, "portaudio initialization failed.\n");
-		fclose(pFILE);
-		return 1;
-	}
+		///////////////////////
+		//initialize port audio
+		///////////////////////
+		global_err = Pa_Initialize();
+		if (global_err != paNoError)
+		{
+			//MessageBox(0,"portaudio initialization failed",0,MB_ICONERROR);
+			if (pFILE) fprintf(pFILE, "portaudio initialization failed.\n");
+			fclose(pFILE);
+			return 1;
+		}
 
-	////////////////////////
-	//audio device selection
-	////////////////////////
-	//SelectAudioInputDevice();
-	SelectAudioOutputDevice();
+		////////////////////////
+		//audio device selection
+		////////////////////////
+		//SelectAudioInputDevice();
+		SelectAudioOutputDevice();
+	}
+	if (global_samplerate <= 0) global_samplerate = SPITMIPS_DEFAULTSAMPLERATE;
+	if (global_framesperbuffer <= 0) global_framesperbuffer = SPITMIPS_DEFAULTFRAMESPERBUFFER;
+	if (pFILE2)
+	{
+		fprintf(pFILE2, "sample rate %d Hz, %d frames per buffer (%.1f ms)\n", global_samplerate, global_framesperbuffer, global_framesperbuffer * 1000.0 / global_samplerate);
+		fflush(pFILE2);
+	}
 
 	///////////////////////
 	//set tonic sample rate 
 	///////////////////////
 	// You don't necessarily have to do this - it will default to 44100 if not set.
-	Tonic::setSampleRate(SAMPLE_RATE);
+	Tonic::setSampleRate(global_samplerate);
 
 	for (int i = 0; i < SPITMIPS_MAXNUMBEROFSAMPLERMODULES; i++)
 	{
@@ -1355,8 +2190,18 @@ int APIENTRY _tWinMain(HINSTANCE hInstance,
 	if (pFILE2)
 	{
 		fprintf(pFILE2, "will load %d sampler module(s)\n", global_numberofsamplermodules);
+		if (global_samplerengine == 1) fprintf(pFILE2, "warning, the native sampler engine is experimental, its polyphony has not been benchmarked against the tonic graph yet\n");
 		fflush(pFILE2);
 	}
+	if (global_notecachebudget_mb > 0 && global_samplerengine == 1)
+	{
+		global_notecache.setup((size_t)global_notecachebudget_mb * 1024 * 1024, (unsigned int)(SPITMIPS_NOTECACHEHEAD_S * global_samplerate), SPITMIPS_NOTECACHEFOLDER, &global_notecacheclient);
+		if (pFILE2) fprintf(pFILE2, "note cache of %d MB for the pitch shifted notes\n", global_notecachebudget_mb);
+	}
+	else if (global_notecachebudget_mb > 0 && pFILE2)
+	{
+		fprintf(pFILE2, "warning, the note cache needs the native sampler, all notes kept resident\n"); //buffer players hold their tables
+	}
 
 	//////////////////////////////////////////
 	//load in samples for each sampler modules
@@ -1372,8 +2217,67 @@ int APIENTRY _tWinMain(HINSTANCE hInstance,
 			fflush(pFILE2);
 		}
 		loadSynthSamples(global_samplesfolders[global_samplermodulesindex], global_samplesfilter);
-		//poly.addVoices(createSynthVoice, 8);
-		poly[global_samplermodulesindex].addVoices(createSynthVoice, SPITMIPS_NUMBEROFVOICES);
+		if (global_voicepoolsize > 0) continue; //voices are set up once for all modules below
+		if (global_samplerengine == 1)
+		{
+			global_polysampler[global_samplermodulesindex]
+				.attack(0.04)
+				.decay(0.1)
+				.sustain(0.8)
+				.release(SPITMIPS_VOICERELEASE_S);
+				//.setNoteTables(global_ppbuffer[global_samplermodulesindex])
+			setSamplerNoteBank(global_polysampler[global_samplermodulesindex], 0, global_samplermodulesindex);
+			poly[global_samplermodulesindex].setSampler(global_polysampler[global_samplermodulesindex], SPITMIPS_NUMBEROFVOICES);
+		}
+		else
+		{
+			//poly.addVoices(createSynthVoice, 8);
+			poly[global_samplermodulesindex].addVoices(createSynthVoice, SPITMIPS_NUMBEROFVOICES);
+		}
+		poly[global_samplermodulesindex].setReleaseTime(SPITMIPS_VOICERELEASE_S);
+		poly[global_samplermodulesindex].setLogRing(&global_logring);
+		poly[global_samplermodulesindex].setModuleOneShot(global_samplermodulesindex, (global_oneshotmodules >> global_samplermodulesindex) & 1);
+	}
+	if (global_voicepoolsize > 0)
+	{
+		/////////////////////////////////////////////////////
+		//global voice pool, shared by all the sampler modules
+		/////////////////////////////////////////////////////
+		global_pvoicepool = new SpiVoicePool;
+		if (global_samplerengine == 1)
+		{
+			global_polysampler[0]
+				.attack(0.04)
+				.decay(0.1)
+				.sustain(0.8)
+				.release(SPITMIPS_VOICERELEASE_S);
+			for (int i = 0; i < global_numberofsamplermodules; i++)
+			{
+				setSamplerNoteBank(global_polysampler[0], i, i);
+			}
+			global_pvoicepool->setSampler(global_polysampler[0], global_voicepoolsize);
+			global_pvoicepool->setSharedVoices(NULL, NULL, global_numberofsamplermodules);
+		}
+		else
+		{
+			global_ppoolsuperplayer = new SuperBufferPlayer[global_voicepoolsize];
+			global_poolvoiceindex = -1;
+			global_pvoicepool->addVoices(createSynthVoice, global_voicepoolsize);
+			global_pvoicepool->setSharedVoices(global_ppoolsuperplayer, global_keymapslot, global_numberofsamplermodules);
+		}
+		for (int i = 0; i < global_numberofsamplermodules; i++)
+		{
+			global_pvoicepool->setModuleQuota(i, global_voicepoolminvoices, (global_voicepoolmaxvoices > 0) ? global_voicepoolmaxvoices : global_voicepoolsize);
+			global_pvoicepool->setModuleOneShot(i, (global_oneshotmodules >> i) & 1);
+		}
+		global_pvoicepool->setReleaseTime(SPITMIPS_VOICERELEASE_S);
+		global_pvoicepool->setLogRing(&global_logring);
+		if (pFILE2)
+		{
+			fprintf(pFILE2, "global voice pool of %d voices for %d sampler module(s), %d to %d voices per module\n",
+				global_voicepoolsize, global_numberofsamplermodules, global_voicepoolminvoices, (global_voicepoolmaxvoices > 0) ? global_voicepoolmaxvoices : global_voicepoolsize);
+			fflush(pFILE2);
+		}
 	}
 
 	StereoDelay delay = StereoDelay(3.0f, 3.0f)
@@ -1385,30 +2289,85 @@ int APIENTRY _tWinMain(HINSTANCE hInstance,
 
 	for (global_samplermodulesindex = 0; global_samplermodulesindex < global_numberofsamplermodules; global_samplermodulesindex++)
 	{
-		synth.setOutputGen(synth.getOutputGen() + poly[global_samplermodulesindex]);
+		//synth.setOutputGen(synth.getOutputGen() + poly[global_samplermodulesindex]);
+		if (global_pvoicepool) break;
+		global_masterbus.addInput(poly[global_samplermodulesindex]);
 	}
+	if (global_pvoicepool)
+	{
+		global_masterbus.addInput(*global_pvoicepool); //one input, the render pool has nothing to split
+	}
+	//polyphony governor, from the full per module polyphony down to global_polyphonygovernorminvoices
+	int maxmodulevoices = SPITMIPS_NUMBEROFVOICES;
+	if (global_pvoicepool) maxmodulevoices = (global_voicepoolmaxvoices > 0) ? global_voicepoolmaxvoices : global_voicepoolsize;
+	global_polyphonygovernor.setup(global_polyphonygovernorload, SPITMIPS_POLYPHONYHYSTERESIS_PERCENT, global_polyphonygovernorminvoices, maxmodulevoices);
+	if (global_renderthreads != 0)
+	{
+		///////////////////////////////////////////////////
+		//render the modules in parallel on the worker pool
+		///////////////////////////////////////////////////
+		global_renderpool.start(global_renderthreads);
+		global_masterbus.setRenderPool(&global_renderpool);
+		if (pFILE2)
+		{
+			fprintf(pFILE2, "rendering %d sampler module(s) on %d worker thread(s) plus the audio thread\n", global_numberofsamplermodules, global_renderpool.getNumberOfThreads());
+			fflush(pFILE2);
+		}
+	}
+	synth.setOutputGen(global_masterbus);
 
 	//synth.setOutputGen(poly >> delay);
+	if (global_antidenormal == 1)
+	{
+		//keeps the feedback tail above the denormal range, the dc offset is far below the 24 bit noise floor
+		synth.setOutputGen(synth.getOutputGen() + FixedValue(SPIDENORMAL_ANTIDENORMAL));
+	}
+	else if (global_antidenormal == 2)
+	{
+		//same, for paths that block dc
+		synth.setOutputGen(synth.getOutputGen() + Noise() * SPIDENORMAL_ANTIDENORMAL);
+	}
 	synth.setOutputGen(synth.getOutputGen() >> delay);
 
+	if (offline)
+	{
+		/////////////////////////////////////////
+		//headless, render the midi file and quit
+		/////////////////////////////////////////
+		int result = RenderMidiFileOffline(global_offlinemidifile, global_offlinewavfile);
+		global_renderpool.stop();
+		for (global_samplermodulesindex = 0; global_samplermodulesindex < global_numberofsamplermodules; global_samplermodulesindex++)
+		{
+			unloadSynthSamples();
+		}
+		global_notecache.clear();
+		delete[] global_ppoolsuperplayer;
+		if (pFILE) fclose(pFILE);
+		if (pFILE2) fclose(pFILE2);
+		return result;
+	}
+
+	global_notecache.start(); //no-op without a budget
+
 	//////////////
 	//setup stream  
 	//////////////
-	global_err = Pa_OpenStream(
-		&global_stream,
-		NULL, //NULL, //&global_inputParameters,
-		&global_outputParameters,
-		SAMPLE_RATE,
-		FRAMES_PER_BUFFER,
-		0, //paClipOff,      // we won't output out of range samples so don't bother clipping them
-		renderCallback,
-		NULL); //no callback userData
-	if (global_err != paNoError)
-	{
-		char errorbuf[2048];
-		sprintf(errorbuf, "Unable to open stream: %s\n", Pa_GetErrorText(global_err));
+	if (global_audiobackend == 1)
+	{
+		global_paudiobackend = new SpiNullAudioBackend();
+	}
+	else if (global_audiobackend == 2)
+	{
+		global_paudiobackend = new SpiFileAudioBackend(global_audiobackendfile);
+	}
+	else
+	{
+		global_paudiobackend = new SpiPortAudioBackend(&global_outputParameters);
+	}
+	if (!global_paudiobackend->open(global_samplerate, global_framesperbuffer, NUM_CHANNELS, renderCallback, NULL)) //no callback userData
+	{
 		//MessageBox(0,errorbuf,0,MB_ICONERROR);
-		if (pFILE) fprintf(pFILE, "%s\n", errorbuf);
+		if (pFILE) fprintf(pFILE, "%s\n", global_paudiobackend->getLastError());
 		fclose(pFILE);
 		return 1;
 	}
@@ -1418,16 +2377,18 @@ int APIENTRY _tWinMain(HINSTANCE hInstance,
 	//////////////
 	//start stream  
 	//////////////
-	global_err = Pa_StartStream(global_stream);
-	if (global_err != paNoError)
+	if (!global_paudiobackend->start())
 	{
-		char errorbuf[2048];
-		sprintf(errorbuf, "Unable to start stream: %s\n", Pa_GetErrorText(global_err));
 		//MessageBox(0,errorbuf,0,MB_ICONERROR);
-		if (pFILE) fprintf(pFILE, "%s\n", errorbuf);
+		if (pFILE) fprintf(pFILE, "%s\n", global_paudiobackend->getLastError());
 		fclose(pFILE);
 		return 1;
 	}
+	if (pFILE2)
+	{
+		fprintf(pFILE2, "%s audio backend started, %.1f ms output latency\n", global_paudiobackend->getName(), global_paudiobackend->getOutputLatency() * 1000.0);
+		fflush(pFILE2);
+	}
 
 
 
@@ -1610,8 +2571,23 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 
 
 			global_timer=timeSetEvent(1000,25,(LPTIMECALLBACK)&StartGlobalProcess,0,TIME_ONESHOT);
+			//spi, begin
+			if (global_logring.isEnabled()) SetTimer(hWnd, SPITMIPS_LOGTIMER_ID, SPITMIPS_LOGTIMER_MS, NULL);
+			if (global_loadmeterdisplay_s > 0) SetTimer(hWnd, SPITMIPS_LOADTIMER_ID, global_loadmeterdisplay_s * 1000, NULL);
+			//spi, end
+		}
+		break;
+	//spi, begin
+	case WM_TIMER:
+		if (wParam == SPITMIPS_LOGTIMER_ID) DrainLogRing();
+		if (wParam == SPITMIPS_LOADTIMER_ID && global_loadmeter.getNumberOfBlocks() > 0)
+		{
+			char text[256];
+			global_loadmeter.format(text, sizeof(text));
+			StatusAddTextA(text);
 		}
 		break;
+	//spi, end
 	case WM_SIZE:
 		{
 			RECT rcClient;
@@ -1711,32 +2687,78 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 			Pt_Stop();
 			Pm_Terminate();
 			//spi, begin
-			/////////////////////
-			//terminate portaudio
-			/////////////////////
-			global_err = Pa_StopStream(global_stream);
-			if (global_err != paNoError)
+			/////////////////////////
+			//terminate audio backend
+			/////////////////////////
+			if (!global_paudiobackend->stop())
 			{
-				char errorbuf[2048];
-				sprintf(errorbuf, "Error stoping stream: %s\n", Pa_GetErrorText(global_err));
-				MessageBoxA(0, errorbuf, 0, MB_ICONERROR);
+				MessageBoxA(0, global_paudiobackend->getLastError(), 0, MB_ICONERROR);
 				return 1;
 			}
-			global_err = Pa_CloseStream(global_stream);
-			if (global_err != paNoError)
+			if (global_audiobackend == 2 && pFILE2 && ((SpiFileAudioBackend*)global_paudiobackend)->getNumberOfDroppedFrames() > 0)
 			{
-				char errorbuf[2048];
-				sprintf(errorbuf, "Error closing stream: %s\n", Pa_GetErrorText(global_err));
-				MessageBoxA(0, errorbuf, 0, MB_ICONERROR);
-				return 1;
+				fprintf(pFILE2, "wav file ring full, %d frames dropped from %s\n", (int)((SpiFileAudioBackend*)global_paudiobackend)->getNumberOfDroppedFrames(), global_audiobackendfile.c_str());
+			}
+			global_paudiobackend->close();
+			delete global_paudiobackend;
+			global_paudiobackend = NULL;
+			if (global_audiobackend == 0) Pa_Terminate();
+			global_renderpool.stop();
+			global_notecache.stop();
+			KillTimer(hWnd, SPITMIPS_LOGTIMER_ID);
+			KillTimer(hWnd, SPITMIPS_LOADTIMER_ID);
+			FILE* pFILELOADMETER = fopen("loadmeter.txt", "w");
+			global_loadmeter.report(pFILELOADMETER);
+			if (pFILELOADMETER && global_polyphonygovernor.isEnabled())
+			{
+				fprintf(pFILELOADMETER, "polyphony governor: %d reductions, lowest limit %d voices per module\n",
+					(int)global_polyphonygovernor.getNumberOfReductions(), global_polyphonygovernor.getLowestVoiceLimit());
+			}
+			if (pFILELOADMETER && global_notecache.isEnabled())
+			{
+				long headstarts = 0;
+				long headunderruns = 0;
+				for (int i = 0; i < SPITMIPS_MAXNUMBEROFSAMPLERMODULES; i++)
+				{
+					headstarts += global_polysampler[i].getNumberOfHeadStarts();
+					headunderruns += global_polysampler[i].getNumberOfHeadUnderruns();
+				}
+				fprintf(pFILELOADMETER, "note cache: %.1f MB peak resident plus %.1f MB of heads, %d evictions, %d reloads, %d note ons started on the head\n",
+					global_notecache.getPeakResidentBytes() / (1024.0 * 1024.0), global_notecache.getHeadBytes() / (1024.0 * 1024.0),
+					(int)global_notecache.getNumberOfEvictions(), (int)global_notecache.getNumberOfReloads(), (int)headstarts);
+				if (headunderruns > 0)
+				{
+					//a voice played through its head before the reload, it went silent until the note was back
+					fprintf(pFILELOADMETER, "FAULT, note cache: %d voices ran out of head before their note was reloaded, raise the budget\n", (int)headunderruns);
+				}
+			}
+			if (pFILELOADMETER && global_samplememory > 0)
+			{
+				fprintf(pFILELOADMETER, "sample memory: %.1f MB prefaulted, %.1f MB locked\n",
+					global_samplememoryprefaulted / (1024.0 * 1024.0), global_samplememorylocked / (1024.0 * 1024.0));
+			}
+			if (pFILELOADMETER && global_logring.isEnabled())
+			{
+				fprintf(pFILELOADMETER, "log ring: %d midi monitor and note records dropped while the ring was full\n", (int)global_logring.getNumberOfDroppedRecords());
+			}
+			if (pFILELOADMETER) fclose(pFILELOADMETER);
+#if SPIRTCHECK_ENABLED
+			FILE* pFILERTCHECK = fopen("rtcheck.txt", "w");
+			SpiRtCheck_Report(pFILERTCHECK);
+			if (pFILERTCHECK) fclose(pFILERTCHECK);
+#endif
+			if (pFILE2 && global_midieventqueue.getNumberOfDroppedEvents() > 0)
+			{
+				fprintf(pFILE2, "midi event queue full, %d note events dropped\n", (int)global_midieventqueue.getNumberOfDroppedEvents());
 			}
-			Pa_Terminate();
 			//spi, end
 			//delete all memory allocations
 			for (global_samplermodulesindex = 0; global_samplermodulesindex < global_numberofsamplermodules; global_samplermodulesindex++)
 			{
 				unloadSynthSamples();
 			}
+			delete[] global_ppoolsuperplayer;
+			global_notecache.clear();
 			//if(global_pInstrument) delete global_pInstrument;
 			//close file
 			if(global_pfile) fclose(global_pfile);